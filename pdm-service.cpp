@@ -30,6 +30,8 @@
 
 #include <thread>
 #include <cmath>
+#include <unordered_set>
+#include <bitset>
 
 #include "pdm-service.hpp"
 
@@ -62,67 +64,931 @@ using gauss_kronrod = boost::math::quadrature::gauss_kronrod<Number,150>; // bes
 // those 2 funcs can be used to preload a weight tables - for 61 they are hardocded
 // but if you are changing it - please reference boost docs
 
-class RbdModel{
-    struct _visitor {
-        const Number &timespan;
-        std::optional<Number> result;
-        _visitor(const Number& ts)
-            :timespan(ts) {}
-        void operator()(const details::Node& node) {
-            if(node.fr == 0_Nr)
-            {
-                result = 1_Nr;
+// предел числа слагаемых аналитического разложения R(t), после которого MTBF считается квадратурой
+constexpr std::size_t rbd_closed_form_max_terms = 4096;
+// предел размера BDD схемы с повторяющимися компонентами
+constexpr std::size_t rbd_bdd_max_nodes = 1 << 20;
+// допустимая относительная погрешность расчета R(t) в long double, иначе расчет в Number
+constexpr long double rbd_fast_path_tolerance = 1e-12L;
+// предел числа промежуточных минимальных сечений схемы
+constexpr std::size_t rbd_cut_sets_max = 1 << 16;
+// кривая R(t): начальная сетка, предел точек и проходов сгущения, допустимое отклонение R от хорды
+constexpr std::size_t rbd_curve_initial_points = 33;
+constexpr std::size_t rbd_curve_max_points = 8193;
+constexpr std::size_t rbd_curve_max_passes = 12;
+constexpr long double rbd_curve_tolerance = 1e-4L;
+constexpr std::uint32_t rbd_curve_default_points = 200;
+// окно, в течение которого пересчеты разных запросов схлопываются, мс
+constexpr std::int64_t rbd_recalculation_debounce = 200;
+// число попыток фонового пересчета одной пачки целей
+constexpr std::size_t rbd_recalculation_attempts = 3;
+// предел числа разобранных расширений узлов ССН в кэше
+constexpr std::size_t rbd_extensions_max = 1 << 16;
+// число компонентов одного родителя в блоках схемы, начиная с которого они читаются слоем
+constexpr std::size_t rbd_components_layer_min = 4;
+
+// Слагаемые c*exp(-r*t) аналитического разложения R(t), пары (r, c)
+using RbdTerms = std::vector<std::pair<Number, Number>>;
+
+// приводит подобные и выбрасывает нулевые слагаемые
+void mergeRbdTerms(RbdTerms &t) {
+    std::sort(t.begin(), t.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+    auto out = t.begin();
+    for(auto it = t.begin(); it != t.end(); ++it) {
+        if(out != t.begin() && std::prev(out)->first == it->first) {
+            std::prev(out)->second += it->second;
+        }
+        else {
+            *out++ = std::move(*it);
+        }
+    }
+    t.erase(out, t.end());
+    t.erase(std::remove_if(t.begin(), t.end(), [](const auto &term) { return term.second == 0_Nr; }), t.end());
+}
+
+// интеграл суммы слагаемых на [0, +inf)
+std::optional<Number> integrateRbdTerms(const RbdTerms &terms) {
+    Number result = 0_Nr;
+    for(const auto &[rate, coef]:terms) {
+        if(rate == 0_Nr) {
+            // ненулевая постоянная составляющая - наработка бесконечна
+            return std::numeric_limits<Number>::infinity();
+        }
+        result += coef / rate;
+    }
+    if(!isfinite(result) || result < 0_Nr) return std::nullopt;
+    return result;
+}
+
+// Вероятность того, что работоспособны не меньше k из n независимых операндов, за O(n*k).
+// dp[j] - вероятность ровно j работающих среди уже просмотренных, dp[k] - не меньше k
+template<typename T, typename Value>
+T rbdVoting(std::size_t n, std::uint32_t k, Value value, std::vector<T> &dp) {
+    dp.assign(k + 1, T(0));
+    dp[0] = T(1);
+    for(std::size_t i = 0; i < n; ++i) {
+        const T r = value(i);
+        dp[k] += dp[k - 1] * r;
+        for(std::uint32_t j = k - 1; j > 0; --j) {
+            dp[j] = dp[j] * (T(1) - r) + dp[j - 1] * r;
+        }
+        dp[0] *= (T(1) - r);
+    }
+    return dp[k];
+}
+
+// ROBDD схемы по переменным-компонентам.
+// Когда один компонент привязан к нескольким блокам, ветви схемы зависимы
+// и последовательно-параллельная свертка дает неверный результат
+class RbdBdd{
+    static constexpr std::uint32_t zero = 0;
+    static constexpr std::uint32_t one = 1;
+
+    details::RbdProgram &p;
+    std::map<std::tuple<std::uint32_t, std::uint32_t, std::uint32_t>, std::uint32_t> unique;
+    std::map<std::tuple<details::RbdOpCode, std::uint32_t, std::uint32_t>, std::uint32_t> computed;
+    bool overflow = false;
+    // кадр обхода apply: пара узлов и уже посчитанные ветви
+    struct Frame{
+        std::uint32_t a;
+        std::uint32_t b;
+        std::uint32_t low = zero;
+        std::uint32_t high = zero;
+        std::uint8_t stage = 0; // 0 - нужна low, 1 - нужна high, 2 - обе готовы
+    };
+    std::vector<Frame> frames;
+    std::size_t maxNodes;
+
+    RbdBdd(details::RbdProgram &program, std::size_t limit):p(program),maxNodes(limit){
+        const auto terminal = std::numeric_limits<std::uint32_t>::max();
+        p.bdd = {{terminal, zero, zero}, {terminal, one, one}};
+    }
+    std::uint32_t mk(std::uint32_t var, std::uint32_t low, std::uint32_t high) {
+        if(low == high) return low;
+        auto [it, inserted] = unique.emplace(std::make_tuple(var, low, high), static_cast<std::uint32_t>(p.bdd.size()));
+        if(inserted) {
+            if(p.bdd.size() >= maxNodes) {
+                overflow = true;
+                return zero;
+            }
+            p.bdd.push_back({var, low, high});
+        }
+        return it->second;
+    }
+    // результат без спуска по диаграмме: терминальный случай или уже посчитанная пара
+    bool resolve(details::RbdOpCode code, std::uint32_t &a, std::uint32_t &b, std::uint32_t &r) const {
+        if(overflow) {
+            r = zero;
+            return true;
+        }
+        const bool conj = code == details::RbdOpCode::series;
+        const auto absorbing = conj ? zero : one;
+        const auto neutral = conj ? one : zero;
+        if(a == absorbing || b == absorbing) r = absorbing;
+        else if(a == neutral || a == b) r = b;
+        else if(b == neutral) r = a;
+        else {
+            if(a > b) std::swap(a, b);
+            auto it = computed.find(std::make_tuple(code, a, b));
+            if(it == computed.end()) return false;
+            r = it->second;
+        }
+        return true;
+    }
+    // series - конъюнкция, reserved - дизъюнкция.
+    // Обход со своим стеком: глубина равна числу переменных и не ограничена стеком корутины
+    std::uint32_t apply(details::RbdOpCode code, std::uint32_t a, std::uint32_t b) {
+        std::uint32_t r = zero;
+        if(resolve(code, a, b, r)) return r;
+        frames.clear();
+        frames.push_back({a, b});
+        while(true) {
+            auto &f = frames.back();
+            // узлы в p.bdd могут переехать при вставке, берем копии
+            const auto na = p.bdd[f.a];
+            const auto nb = p.bdd[f.b];
+            const auto var = std::min(na.var, nb.var);
+            if(f.stage == 2) {
+                r = mk(var, f.low, f.high);
+                if(overflow) return zero;
+                computed.emplace(std::make_tuple(code, f.a, f.b), r);
+                frames.pop_back();
+                if(frames.empty()) return r;
+                auto &parent = frames.back();
+                (parent.stage == 0 ? parent.low : parent.high) = r;
+                ++parent.stage;
+                continue;
+            }
+            auto ca = na.var == var ? (f.stage == 0 ? na.low : na.high) : f.a;
+            auto cb = nb.var == var ? (f.stage == 0 ? nb.low : nb.high) : f.b;
+            if(resolve(code, ca, cb, r)) {
+                (f.stage == 0 ? f.low : f.high) = r;
+                ++f.stage;
             }
             else {
-                result = exp(-node.fr * timespan);
+                frames.push_back({ca, cb});
             }
         }
-        void operator()(const details::LinearModelPtr& linear) {
-            if(!linear) return;
-            for(const auto& part:linear->chain) {
-                auto vis = _visitor(timespan);
-                std::visit(vis,part);
-                if(!vis.result.has_value()) {
-                    continue;
+    }
+public:
+    // false - диаграмма не уложилась в maxNodes узлов
+    static bool build(details::RbdProgram &program, std::size_t maxNodes = rbd_bdd_max_nodes) {
+        RbdBdd b(program, maxNodes);
+        std::vector<std::uint32_t> roots;
+        for(const auto &op:program.ops) {
+            switch(op.code) {
+                case details::RbdOpCode::leaf:
+                    roots.push_back(b.mk(program.leafVars[op.arg], zero, one));
+                    break;
+                case details::RbdOpCode::series:
+                case details::RbdOpCode::reserved: {
+                    auto first = roots.end() - op.arg;
+                    auto r = *first;
+                    for(auto it = first + 1; it != roots.end(); ++it) {
+                        r = b.apply(op.code, r, *it);
+                    }
+                    roots.erase(first, roots.end());
+                    roots.push_back(r);
+                    break;
                 }
-                if(result.has_value()) {
-                    result.value() *= vis.result.value();
+                case details::RbdOpCode::voting: {
+                    // at_least[j] - работают не меньше j из операндов правее текущего
+                    auto first = roots.end() - op.arg;
+                    std::vector<std::uint32_t> at_least(op.k + 1, zero);
+                    at_least[0] = one;
+                    for(auto it = roots.end(); it != first;) {
+                        --it;
+                        for(std::uint32_t j = op.k; j > 0; --j) {
+                            at_least[j] = b.apply(details::RbdOpCode::reserved,
+                                                  b.apply(details::RbdOpCode::series, *it, at_least[j - 1]),
+                                                  at_least[j]);
+                        }
+                    }
+                    roots.erase(first, roots.end());
+                    roots.push_back(at_least[op.k]);
+                    break;
                 }
-                else {
-                    result = vis.result;
+            }
+            if(b.overflow) {
+                program.bdd.clear();
+                return false;
+            }
+        }
+        program.bddRoot = roots.back();
+        return true;
+    }
+    // вероятности узлов для n моментов времени, узлы идут от листьев к корню.
+    // vars и probs - буферы вызывающего, возвращается строка корня в probs
+    static const Number *reliability(const details::RbdProgram &p, const Number *timespans, std::size_t n,
+                                     std::vector<Number> &vars, std::vector<Number> &probs) {
+        vars.resize(p.varLeaves.size() * n);
+        for(std::size_t v = 0; v < p.varLeaves.size(); ++v) {
+            const Number &fr = p.rates[p.varLeaves[v]];
+            for(std::size_t i = 0; i < n; ++i) {
+                vars[v * n + i] = (fr == 0_Nr) ? 1_Nr : Number(exp(-fr * timespans[i]));
+            }
+        }
+        probs.resize(p.bdd.size() * n);
+        std::fill(probs.begin(), probs.begin() + n, 0_Nr);
+        std::fill(probs.begin() + n, probs.begin() + 2 * n, 1_Nr);
+        for(std::size_t k = 2; k < p.bdd.size(); ++k) {
+            const auto &node = p.bdd[k];
+            const Number *q = vars.data() + node.var * n;
+            const Number *low = probs.data() + node.low * n;
+            const Number *high = probs.data() + node.high * n;
+            Number *r = probs.data() + k * n;
+            for(std::size_t i = 0; i < n; ++i) {
+                r[i] = low[i] + q[i] * (high[i] - low[i]);
+            }
+        }
+        return probs.data() + p.bddRoot * n;
+    }
+    // Значимость по Бирнбауму dR/dq переменной - сумма по ее узлам вероятности дойти до узла,
+    // умноженной на разность вероятностей его ветвей
+    static Number importance(const details::RbdProgram &p, const Number &timespan, std::vector<Number> &birnbaum) {
+        std::vector<Number> lanes;
+        std::vector<Number> probs;
+        auto r = *reliability(p, &timespan, 1, lanes, probs);
+        std::vector<Number> reach(p.bdd.size(), 0_Nr);
+        std::vector<Number> vars(p.varLeaves.size(), 0_Nr);
+        reach[p.bddRoot] = 1_Nr;
+        // родители создаются позже потомков, поэтому идем от конца
+        for(std::size_t k = p.bdd.size(); k-- > 2;) {
+            const auto &node = p.bdd[k];
+            if(reach[k] == 0_Nr) continue;
+            const Number &fr = p.rates[p.varLeaves[node.var]];
+            const Number q = (fr == 0_Nr) ? 1_Nr : Number(exp(-fr * timespan));
+            reach[node.low] += reach[k] * (1_Nr - q);
+            reach[node.high] += reach[k] * q;
+            vars[node.var] += reach[k] * (probs[node.high] - probs[node.low]);
+        }
+        for(std::size_t slot = 0; slot < birnbaum.size(); ++slot) {
+            birnbaum[slot] = vars[p.leafVars[slot]];
+        }
+        return r;
+    }
+    // Точный интеграл R(t): на каждом пути диаграммы переменная встречается не больше раза,
+    // поэтому P(узла) = P(low) + exp(-r*t) * (P(high) - P(low)) раскладывается без степеней exp
+    static std::optional<Number> integrate(const details::RbdProgram &p, std::size_t maxTerms) {
+        std::vector<RbdTerms> terms(p.bdd.size());
+        terms[one] = RbdTerms{{0_Nr, 1_Nr}};
+        for(std::size_t k = 2; k < p.bdd.size(); ++k) {
+            const auto &node = p.bdd[k];
+            const Number &fr = p.rates[p.varLeaves[node.var]];
+            const auto &low = terms[node.low];
+            const auto &high = terms[node.high];
+            if(2 * low.size() + high.size() > maxTerms) return std::nullopt;
+            auto &r = terms[k];
+            r.reserve(2 * low.size() + high.size());
+            r.insert(r.end(), low.begin(), low.end());
+            for(const auto &[rate, coef]:high) {
+                r.emplace_back(rate + fr, coef);
+            }
+            for(const auto &[rate, coef]:low) {
+                r.emplace_back(rate + fr, -coef);
+            }
+            mergeRbdTerms(r);
+        }
+        return integrateRbdTerms(terms[p.bddRoot]);
+    }
+};
+
+// Минимальные сечения (или пути) схемы снизу вверх по постфиксной программе, как в MOCUS:
+// множество переменных - биты, надмножества уже найденных множеств отбрасываются на каждом шаге
+class RbdCutSets{
+    using Set = std::vector<std::uint64_t>;
+    using Family = std::vector<Set>;
+
+    const std::uint32_t order;
+    const std::size_t limit;
+    const std::size_t words;
+    bool overflow = false;
+
+    RbdCutSets(const details::RbdProgram &program, std::uint32_t order, std::size_t limit)
+        :order(order),limit(limit),words((program.varLeaves.size() + 63) / 64){}
+
+    static std::uint32_t count(const Set &s) {
+        std::uint32_t n = 0;
+        for(auto w:s) n += std::bitset<64>(w).count();
+        return n;
+    }
+    static bool subset(const Set &a, const Set &b) {
+        for(std::size_t i = 0; i < a.size(); ++i) {
+            if(a[i] & ~b[i]) return false;
+        }
+        return true;
+    }
+    // оставляет только минимальные множества, короткие идут первыми
+    static void minimize(Family &f) {
+        std::sort(f.begin(), f.end(), [](const Set &a, const Set &b) {
+            auto ca = count(a), cb = count(b);
+            return ca != cb ? ca < cb : a < b;
+        });
+        f.erase(std::unique(f.begin(), f.end()), f.end());
+        Family kept;
+        for(auto &s:f) {
+            if(std::none_of(kept.begin(), kept.end(), [&s](const Set &k) { return subset(k, s); })) {
+                kept.push_back(std::move(s));
+            }
+        }
+        f = std::move(kept);
+    }
+    // ИЛИ: объединение семейств
+    void unite(Family &a, const Family &b) {
+        a.insert(a.end(), b.begin(), b.end());
+        minimize(a);
+        if(a.size() > limit) overflow = true;
+    }
+    // И: попарные объединения множеств, длиннее order не нужны
+    Family product(const Family &a, const Family &b) {
+        Family r;
+        for(const auto &x:a) {
+            for(const auto &y:b) {
+                Set z(words);
+                for(std::size_t i = 0; i < words; ++i) z[i] = x[i] | y[i];
+                if(count(z) > order) continue;
+                r.push_back(std::move(z));
+            }
+            if(r.size() > limit * 4) minimize(r);
+            if(r.size() > limit) {
+                overflow = true;
+                return r;
+            }
+        }
+        minimize(r);
+        if(r.size() > limit) overflow = true;
+        return r;
+    }
+    // не меньше m из операндов: at_least[j] - не меньше j среди уже разобранных
+    Family atLeast(std::vector<Family>::iterator first, std::vector<Family>::iterator last, std::uint32_t m) {
+        std::vector<Family> at_least(m + 1);
+        at_least[0].push_back(Set(words));
+        for(auto it = first; it != last && !overflow; ++it) {
+            for(std::uint32_t j = m; j > 0 && !overflow; --j) {
+                if(at_least[j - 1].empty()) continue;
+                unite(at_least[j], product(at_least[j - 1], *it));
+            }
+        }
+        return std::move(at_least[m]);
+    }
+public:
+    // paths == false - сечения (наборы отказов), true - пути (наборы работающих);
+    // false - промежуточное семейство превысило limit
+    static bool compute(const details::RbdProgram &program, bool paths, std::uint32_t order, std::size_t limit,
+                        std::vector<std::vector<std::uint32_t>> &result) {
+        result.clear();
+        if(program.ops.empty()) return true;
+        RbdCutSets c(program, order, limit);
+        std::vector<Family> stack;
+        for(const auto &op:program.ops) {
+            if(op.code == details::RbdOpCode::leaf) {
+                Family f;
+                if(order > 0) {
+                    Set s(c.words);
+                    const auto var = program.leafVars[op.arg];
+                    s[var / 64] |= std::uint64_t(1) << (var % 64);
+                    f.push_back(std::move(s));
+                }
+                stack.push_back(std::move(f));
+                continue;
+            }
+            auto first = stack.end() - op.arg;
+            const std::uint32_t n = op.arg;
+            // последовательное соединение отказывает при отказе любого операнда, резерв - всех,
+            // k из n - при отказе n-k+1; для путей наоборот
+            std::uint32_t m = 0;
+            switch(op.code) {
+                case details::RbdOpCode::series:   m = paths ? n : 1; break;
+                case details::RbdOpCode::reserved: m = paths ? 1 : n; break;
+                case details::RbdOpCode::voting:   m = paths ? op.k : n - op.k + 1; break;
+                default: break;
+            }
+            Family f;
+            if(m == 1) {
+                for(auto it = first; it != stack.end() && !c.overflow; ++it) c.unite(f, *it);
+            }
+            else {
+                f = c.atLeast(first, stack.end(), m);
+            }
+            if(c.overflow) return false;
+            stack.erase(first, stack.end());
+            stack.push_back(std::move(f));
+        }
+        for(const auto &s:stack.back()) {
+            std::vector<std::uint32_t> vars;
+            for(std::uint32_t v = 0; v < program.varLeaves.size(); ++v) {
+                if(s[v / 64] & (std::uint64_t(1) << (v % 64))) vars.push_back(v);
+            }
+            result.push_back(std::move(vars));
+        }
+        return true;
+    }
+};
+
+class RbdModel{
+    // разворачивает дерево модели в постфиксную программу, возвращает количество операндов
+    struct _compiler {
+        details::RbdProgram &program;
+        std::size_t sp = 0;
+        std::map<std::string, std::uint32_t> vars;
+        std::vector<std::string> leaves;
+        std::size_t operator()(const details::Node& node) {
+            // листья одного компонента - одна переменная, непривязанный лист - своя
+            auto var = static_cast<std::uint32_t>(program.varLeaves.size());
+            if(!node.ref.empty()) {
+                var = vars.emplace(node.ref, var).first->second;
+            }
+            if(var == program.varLeaves.size()) {
+                program.varLeaves.push_back(static_cast<std::uint32_t>(program.rates.size()));
+            }
+            program.leafVars.push_back(var);
+            program.leafOps.push_back(append(details::RbdOpCode::leaf, program.rates.size(), 1));
+            program.rates.push_back(node.fr);
+            leaves.push_back(node.semantic);
+            push(1);
+            return 1;
+        }
+        std::size_t operator()(const details::LinearModelPtr& linear) {
+            if(!linear) return 0;
+            return emit(details::RbdOpCode::series, linear->chain);
+        }
+        std::size_t operator()(const details::ReservedModelPtr& reserved) {
+            if(!reserved) return 0;
+            return emit(details::RbdOpCode::reserved, reserved->chains, reserved->k);
+        }
+    private:
+        std::size_t emit(details::RbdOpCode code, const std::vector<details::RBDPartModel>& parts, std::uint32_t k = 1) {
+            const auto first = program.ops.size();
+            std::uint32_t arity = 0;
+            for(const auto& part:parts) {
+                arity += std::visit(*this, part);
+            }
+            if(arity == 0) return 0;
+            // k не больше arity: getRbdReservedModel отклоняет группу, где ветвей со значениями меньше k
+            if(code == details::RbdOpCode::reserved && k > 1) {
+                code = details::RbdOpCode::voting;
+            }
+            auto op = append(code, arity, program.ops.size() - first + 1);
+            program.ops[op].k = k;
+            for(std::uint32_t operand = 0, c = op - 1; operand < arity; ++operand, c -= program.sizes[c]) {
+                program.parents[c] = op;
+            }
+            sp -= arity;
+            push(1);
+            return 1;
+        }
+        std::uint32_t append(details::RbdOpCode code, std::size_t arg, std::size_t size) {
+            program.ops.push_back({code, static_cast<std::uint32_t>(arg)});
+            program.sizes.push_back(static_cast<std::uint32_t>(size));
+            program.parents.push_back(std::numeric_limits<std::uint32_t>::max());
+            return static_cast<std::uint32_t>(program.ops.size() - 1);
+        }
+        void push(std::size_t n) {
+            sp += n;
+            program.depth = std::max(program.depth, sp);
+        }
+    };
+public:
+    RbdModel(details::RBDPartModel &&model, std::size_t bddMaxNodes = rbd_bdd_max_nodes){
+        auto compiler = _compiler{p};
+        std::visit(compiler, model);
+        p.leaves = std::make_shared<const std::vector<std::string>>(std::move(compiler.leaves));
+        if(p.varLeaves.size() < p.rates.size() && !RbdBdd::build(p, bddMaxNodes)) {
+            WI_LOG_ERROR() << "RBD BDD IS TOO LARGE, DUPLICATED ELEMENTS ARE TREATED AS INDEPENDENT";
+        }
+        prepare();
+    }
+    RbdModel(details::RbdProgram program):p(std::move(program)){
+        prepare();
+    }
+    RbdModel(const PdmService::RbdProgramPtr &program):RbdModel(*program){}
+    // R(t) в long double с оценкой абсолютной погрешности.
+    // Если погрешность велика по сравнению с R или 1-R (R близко к 0 или 1) - считаем в Number
+    std::optional<Number> calculate(const Number &timespan, long double tolerance){
+        if(p.ops.empty()) return std::nullopt;
+        if(!p.bdd.empty()) return calculate(timespan);
+        constexpr long double eps = std::numeric_limits<long double>::epsilon();
+        const auto t = static_cast<long double>(timespan);
+        // (значение, оценка абсолютной погрешности)
+        auto *sp = fastStack.data();
+        for(const auto& op:p.ops) {
+            switch(op.code) {
+                case details::RbdOpCode::leaf: {
+                    const long double fr = fastRates[op.arg];
+                    if(fr == 0.0L) {
+                        *sp++ = {1.0L, 0.0L};
+                    }
+                    else {
+                        const long double v = std::exp(-fr * t);
+                        // ошибка аргумента усиливается экспонентой в fr*t раз
+                        *sp++ = {v, v * eps * (1.0L + fr * t)};
+                    }
+                    break;
+                }
+                case details::RbdOpCode::series: {
+                    sp -= op.arg;
+                    for(std::uint32_t i = 1; i < op.arg; ++i) {
+                        sp[0].first *= sp[i].first;
+                        sp[0].second += sp[i].second;
+                    }
+                    sp[0].second += op.arg * eps;
+                    ++sp;
+                    break;
+                }
+                case details::RbdOpCode::reserved: {
+                    sp -= op.arg;
+                    long double q = 1.0L - sp[0].first;
+                    for(std::uint32_t i = 1; i < op.arg; ++i) {
+                        q *= (1.0L - sp[i].first);
+                        sp[0].second += sp[i].second;
+                    }
+                    sp[0].first = 1.0L - q;
+                    sp[0].second += (2 * op.arg + 1) * eps;
+                    ++sp;
+                    break;
+                }
+                case details::RbdOpCode::voting: {
+                    sp -= op.arg;
+                    const auto *operands = sp;
+                    long double err = 0.0L;
+                    for(std::uint32_t i = 0; i < op.arg; ++i) {
+                        err += operands[i].second;
+                    }
+                    sp[0].first = rbdVoting<long double>(op.arg, op.k, [operands](std::size_t i) { return operands[i].first; }, fastVotes);
+                    sp[0].second = err + 3 * op.arg * op.k * eps;
+                    ++sp;
+                    break;
                 }
             }
         }
-        void operator()(const details::ReservedModelPtr& reserved) {
-            if(!reserved) return;
-            for(const auto& part:reserved->chains) {
-                auto vis = _visitor(timespan);
-                std::visit(vis,part);
-                if(!vis.result.has_value()) continue;
-                if(result.has_value()) {
-                    result.value() *= (1_Nr - vis.result.value());
+        const auto [r, err] = fastStack.front();
+        if(!std::isfinite(r) || err > tolerance * std::min(r, 1.0L - r)) {
+            return calculate(timespan);
+        }
+        return Number(r);
+    }
+    std::optional<Number> calculate(const Number &timespan){
+        if(p.ops.empty()) return std::nullopt;
+        if(!p.bdd.empty()) return *RbdBdd::reliability(p, &timespan, 1, varLanes, lanes);
+        Number *sp = stack.data();
+        for(const auto& op:p.ops) {
+            switch(op.code) {
+                case details::RbdOpCode::leaf: {
+                    const Number &fr = p.rates[op.arg];
+                    *sp++ = (fr == 0_Nr) ? 1_Nr : Number(exp(-fr * timespan));
+                    break;
                 }
-                else {
-                    result = 1_Nr - vis.result.value();
+                case details::RbdOpCode::series: {
+                    sp -= op.arg;
+                    for(std::uint32_t i = 1; i < op.arg; ++i) {
+                        sp[0] *= sp[i];
+                    }
+                    ++sp;
+                    break;
+                }
+                case details::RbdOpCode::reserved: {
+                    sp -= op.arg;
+                    sp[0] = 1_Nr - sp[0];
+                    for(std::uint32_t i = 1; i < op.arg; ++i) {
+                        sp[0] *= (1_Nr - sp[i]);
+                    }
+                    sp[0] = 1_Nr - sp[0];
+                    ++sp;
+                    break;
+                }
+                case details::RbdOpCode::voting: {
+                    sp -= op.arg;
+                    const Number *operands = sp;
+                    sp[0] = rbdVoting<Number>(op.arg, op.k, [operands](std::size_t i) { return operands[i]; }, votes);
+                    ++sp;
+                    break;
                 }
             }
-            if(result.has_value()) {
-                result = 1_Nr - result.value();
+        }
+        return stack.front();
+    }
+    // R(t) сразу для набора моментов времени, каждая операция проходит по всем точкам подряд
+    std::vector<Number> calculate(const std::vector<Number> &timespans){
+        const std::size_t n = timespans.size();
+        if(p.ops.empty() || n == 0) return {};
+        if(!p.bdd.empty()) {
+            const auto *root = RbdBdd::reliability(p, timespans.data(), n, varLanes, lanes);
+            return std::vector<Number>(root, root + n);
+        }
+        lanes.resize(p.depth * n);
+        Number *sp = lanes.data();
+        for(const auto& op:p.ops) {
+            switch(op.code) {
+                case details::RbdOpCode::leaf: {
+                    const Number &fr = p.rates[op.arg];
+                    if(fr == 0_Nr) {
+                        std::fill(sp, sp + n, 1_Nr);
+                    }
+                    else {
+                        for(std::size_t i = 0; i < n; ++i) {
+                            sp[i] = exp(-fr * timespans[i]);
+                        }
+                    }
+                    sp += n;
+                    break;
+                }
+                case details::RbdOpCode::series: {
+                    sp -= op.arg * n;
+                    for(std::uint32_t k = 1; k < op.arg; ++k) {
+                        const Number *operand = sp + k * n;
+                        for(std::size_t i = 0; i < n; ++i) {
+                            sp[i] *= operand[i];
+                        }
+                    }
+                    sp += n;
+                    break;
+                }
+                case details::RbdOpCode::reserved: {
+                    sp -= op.arg * n;
+                    for(std::size_t i = 0; i < n; ++i) {
+                        sp[i] = 1_Nr - sp[i];
+                    }
+                    for(std::uint32_t k = 1; k < op.arg; ++k) {
+                        const Number *operand = sp + k * n;
+                        for(std::size_t i = 0; i < n; ++i) {
+                            sp[i] *= (1_Nr - operand[i]);
+                        }
+                    }
+                    for(std::size_t i = 0; i < n; ++i) {
+                        sp[i] = 1_Nr - sp[i];
+                    }
+                    sp += n;
+                    break;
+                }
+                case details::RbdOpCode::voting: {
+                    sp -= op.arg * n;
+                    const Number *operands = sp;
+                    for(std::size_t i = 0; i < n; ++i) {
+                        sp[i] = rbdVoting<Number>(op.arg, op.k, [operands, n, i](std::size_t m) { return operands[m * n + i]; }, votes);
+                    }
+                    sp += n;
+                    break;
+                }
             }
         }
-    };
-public:
-    RbdModel(details::RBDPartModel &&model):m(std::move(model)){}
-    std::optional<Number> calculate(Number timespan){
-//        WI_LOG_INFO() << "current model" << toJson(m).dump() ;
-        auto vis = _visitor(timespan);
-        std::visit(vis,m);
-        return vis.result;
+        return std::vector<Number>(lanes.begin(), lanes.begin() + n);
+    }
+    // Точное значение интеграла R(t) на [0, +inf).
+    // R(t) раскладывается в сумму c*exp(-r*t), интеграл которой равен сумме c/r.
+    // Если число слагаемых превышает maxTerms - возвращает nullopt, считать надо квадратурой
+    std::optional<Number> integrate(std::size_t maxTerms) const {
+        if(p.ops.empty()) return std::nullopt;
+        if(!p.bdd.empty()) return RbdBdd::integrate(p, maxTerms);
+        std::vector<RbdTerms> terms;
+        terms.reserve(p.depth);
+
+        auto multiply = [maxTerms](const RbdTerms &a, const RbdTerms &b) -> std::optional<RbdTerms> {
+            if(a.size() * b.size() > maxTerms) return std::nullopt;
+            RbdTerms r;
+            r.reserve(a.size() * b.size());
+            for(const auto &x:a) {
+                for(const auto &y:b) {
+                    r.emplace_back(x.first + y.first, x.second * y.second);
+                }
+            }
+            mergeRbdTerms(r);
+            return r;
+        };
+        // 1 - R
+        auto complement = [](RbdTerms t) {
+            for(auto &term:t) {
+                term.second = -term.second;
+            }
+            t.emplace_back(0_Nr, 1_Nr);
+            mergeRbdTerms(t);
+            return t;
+        };
+
+        for(const auto& op:p.ops) {
+            switch(op.code) {
+                case details::RbdOpCode::leaf: {
+                    terms.push_back(RbdTerms{{p.rates[op.arg], 1_Nr}});
+                    break;
+                }
+                case details::RbdOpCode::series:
+                case details::RbdOpCode::reserved: {
+                    const bool reserved = op.code == details::RbdOpCode::reserved;
+                    auto first = terms.end() - op.arg;
+                    RbdTerms acc = reserved ? complement(std::move(*first)) : std::move(*first);
+                    for(auto it = first + 1; it != terms.end(); ++it) {
+                        auto r = multiply(acc, reserved ? complement(std::move(*it)) : std::move(*it));
+                        if(!r.has_value()) return std::nullopt;
+                        acc = std::move(r.value());
+                    }
+                    if(reserved) {
+                        acc = complement(std::move(acc));
+                    }
+                    terms.erase(first, terms.end());
+                    terms.push_back(std::move(acc));
+                    break;
+                }
+                case details::RbdOpCode::voting: {
+                    // та же рекуррентная формула, что и в rbdVoting, но над слагаемыми
+                    auto first = terms.end() - op.arg;
+                    std::vector<RbdTerms> dp(op.k + 1);
+                    dp[0] = RbdTerms{{0_Nr, 1_Nr}};
+                    auto add = [](RbdTerms a, const RbdTerms &b) {
+                        a.insert(a.end(), b.begin(), b.end());
+                        mergeRbdTerms(a);
+                        return a;
+                    };
+                    for(auto it = first; it != terms.end(); ++it) {
+                        const auto failed = complement(*it);
+                        auto gained = multiply(dp[op.k - 1], *it);
+                        if(!gained.has_value()) return std::nullopt;
+                        dp[op.k] = add(std::move(dp[op.k]), gained.value());
+                        for(std::uint32_t j = op.k - 1; j > 0; --j) {
+                            auto kept = multiply(dp[j], failed);
+                            auto moved = multiply(dp[j - 1], *it);
+                            if(!kept.has_value() || !moved.has_value()) return std::nullopt;
+                            dp[j] = add(std::move(kept.value()), moved.value());
+                        }
+                        auto kept = multiply(dp[0], failed);
+                        if(!kept.has_value()) return std::nullopt;
+                        dp[0] = std::move(kept.value());
+                    }
+                    terms.erase(first, terms.end());
+                    terms.push_back(std::move(dp[op.k]));
+                    break;
+                }
+            }
+        }
+        return integrateRbdTerms(terms.front());
+    }
+    // R(t) с сохранением значений всех операций, повторный вызов для того же t берет готовый корень
+    std::optional<Number> reliability(const Number &timespan){
+        if(p.ops.empty()) return std::nullopt;
+        // на диаграмме частичные значения не ведутся
+        if(!p.bdd.empty()) return calculate(timespan);
+        if(p.timespan.has_value() && p.timespan.value() == timespan) return p.partials.back();
+        p.timespan = timespan;
+        p.partials.resize(p.ops.size());
+        for(std::uint32_t i = 0; i < p.ops.size(); ++i) {
+            p.partials[i] = evaluate(p, i);
+        }
+        return p.partials.back();
+    }
+    // меняет интенсивность листа и пересчитывает только операции на пути от него к корню
+    static void patch(details::RbdProgram &p, std::uint32_t slot, const Number &rate){
+        p.rates[slot] = rate;
+        ++p.revision;
+        if(!p.timespan.has_value()) return;
+        for(auto i = p.leafOps[slot]; i < p.ops.size(); i = p.parents[i]) {
+            p.partials[i] = evaluate(p, i);
+        }
+    }
+    // R(t) и значимость по Бирнбауму dR/dR_i каждого листа за один прямой и один обратный проход
+    std::optional<Number> importance(const Number &timespan, std::vector<Number> &birnbaum){
+        if(p.ops.empty()) return std::nullopt;
+        birnbaum.assign(p.rates.size(), 0_Nr);
+        if(!p.bdd.empty()) return RbdBdd::importance(p, timespan, birnbaum);
+
+        auto r = reliability(timespan);
+        std::vector<Number> adjoint(p.ops.size(), 0_Nr);
+        adjoint.back() = 1_Nr;
+        std::vector<std::uint32_t> operands;
+        std::vector<Number> suffix;
+        // распределения числа работающих операндов голосования левее и правее текущего
+        std::vector<Number> before;
+        std::vector<Number> after;
+        for(auto i = p.ops.size(); i-- > 0;) {
+            const auto &op = p.ops[i];
+            if(op.code == details::RbdOpCode::leaf) {
+                birnbaum[op.arg] = adjoint[i];
+                continue;
+            }
+            operands.clear();
+            for(std::uint32_t k = 0, c = i - 1; k < op.arg; ++k, c -= p.sizes[c]) {
+                operands.push_back(c);
+            }
+            if(op.code == details::RbdOpCode::voting) {
+                // производная по операнду - вероятность, что из остальных работают ровно k-1:
+                // свертка распределений слева и справа от него, счетчики больше k-1 не нужны
+                if(op.k == 0) continue;
+                const std::size_t n = operands.size();
+                const std::size_t w = op.k;
+                auto step = [w](const Number *from, Number *to, const Number &r) {
+                    for(std::size_t m = w; m-- > 0;) {
+                        to[m] = from[m] * (1_Nr - r) + (m > 0 ? from[m - 1] * r : 0_Nr);
+                    }
+                };
+                before.assign((n + 1) * w, 0_Nr);
+                after.assign((n + 1) * w, 0_Nr);
+                before[0] = 1_Nr;
+                after[n * w] = 1_Nr;
+                for(std::size_t j = 0; j < n; ++j) {
+                    step(before.data() + j * w, before.data() + (j + 1) * w, p.partials[operands[j]]);
+                }
+                for(std::size_t j = n; j-- > 0;) {
+                    step(after.data() + (j + 1) * w, after.data() + j * w, p.partials[operands[j]]);
+                }
+                for(std::size_t j = 0; j < n; ++j) {
+                    const Number *left = before.data() + j * w;
+                    const Number *right = after.data() + (j + 1) * w;
+                    Number exactly = 0_Nr;
+                    for(std::size_t m = 0; m < w; ++m) {
+                        exactly += left[m] * right[w - 1 - m];
+                    }
+                    adjoint[operands[j]] += adjoint[i] * exactly;
+                }
+                continue;
+            }
+            // производная по операнду - произведение множителей остальных операндов:
+            // для последовательного соединения их R, для резерва их 1-R
+            const bool series = op.code == details::RbdOpCode::series;
+            auto factor = [&](std::uint32_t c) { return series ? p.partials[c] : Number(1_Nr - p.partials[c]); };
+            suffix.assign(operands.size() + 1, 1_Nr);
+            for(auto j = operands.size(); j-- > 0;) {
+                suffix[j] = suffix[j + 1] * factor(operands[j]);
+            }
+            Number prefix = 1_Nr;
+            for(std::size_t j = 0; j < operands.size(); ++j) {
+                adjoint[operands[j]] += adjoint[i] * prefix * suffix[j + 1];
+                prefix *= factor(operands[j]);
+            }
+        }
+        return r;
     }
+    const details::RbdProgram& program() const { return p; }
+    // забирает программу, модель после этого непригодна
+    details::RbdProgram release() { return std::move(p); }
 private:
-    const details::RBDPartModel m;
+    // значение операции по уже посчитанным значениям ее операндов
+    static Number evaluate(const details::RbdProgram &p, std::uint32_t i){
+        const auto &op = p.ops[i];
+        switch(op.code) {
+            case details::RbdOpCode::leaf: {
+                const Number &fr = p.rates[op.arg];
+                if(fr == 0_Nr) return 1_Nr;
+                return exp(-fr * p.timespan.value());
+            }
+            case details::RbdOpCode::series: {
+                Number r = 1_Nr;
+                for(std::uint32_t k = 0, c = i - 1; k < op.arg; ++k, c -= p.sizes[c]) {
+                    r *= p.partials[c];
+                }
+                return r;
+            }
+            case details::RbdOpCode::reserved: {
+                Number q = 1_Nr;
+                for(std::uint32_t k = 0, c = i - 1; k < op.arg; ++k, c -= p.sizes[c]) {
+                    q *= (1_Nr - p.partials[c]);
+                }
+                return 1_Nr - q;
+            }
+            case details::RbdOpCode::voting: {
+                std::vector<Number> operands;
+                operands.reserve(op.arg);
+                for(std::uint32_t k = 0, c = i - 1; k < op.arg; ++k, c -= p.sizes[c]) {
+                    operands.push_back(p.partials[c]);
+                }
+                std::vector<Number> dp;
+                return rbdVoting<Number>(operands.size(), op.k, [&operands](std::size_t m) { return operands[m]; }, dp);
+            }
+        }
+        return 0_Nr;
+    }
+    void prepare(){
+        stack.resize(p.depth);
+        fastStack.resize(p.depth);
+        fastRates.resize(p.rates.size());
+        std::transform(p.rates.begin(), p.rates.end(), fastRates.begin(), [](const Number &fr) { return static_cast<long double>(fr); });
+    }
+    details::RbdProgram p;
+    std::vector<Number> stack;
+    std::vector<Number> lanes;
+    std::vector<Number> varLanes; // вероятности переменных ROBDD по моментам времени
+    std::vector<long double> fastRates;
+    std::vector<std::pair<long double, long double>> fastStack;
+    std::vector<Number> votes;
+    std::vector<long double> fastVotes;
 };
 
+// части модели ССН для сборки в коде: варианты с unique_ptr не копируются и не собираются списком инициализации
+template<typename... Parts>
+std::vector<details::RBDPartModel> rbdParts(Parts&&... parts) {
+    std::vector<details::RBDPartModel> result;
+    result.reserve(sizeof...(parts));
+    (result.emplace_back(std::forward<Parts>(parts)), ...);
+    return result;
+}
+details::RBDPartModel rbdChain(std::vector<details::RBDPartModel> &&parts) {
+    auto chain = std::make_unique<details::LinearModel>();
+    chain->chain = std::move(parts);
+    return chain;
+}
+details::RBDPartModel rbdGroup(std::vector<details::RBDPartModel> &&parts, std::uint32_t k = 1) {
+    auto group = std::make_unique<details::ReservedModel>();
+    group->chains = std::move(parts);
+    group->k = k;
+    return group;
+}
+
 class PdmMethodGuard;
 class PdmMethodContext:public wi::core::MethodContextInterface, public std::enable_shared_from_this<PdmMethodContext>{
     private:
@@ -130,21 +996,51 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         std::shared_ptr<wi::core::MethodContextInterface> underlying;
         const std::size_t m_initiatingService;
         const std::shared_ptr<IWiSession> sessionPtr;
-        struct{
-            // отсортированы лексикографически >, что бы идти от листьев к корню дерева ЛСИ.
-            std::set<std::string,std::greater<std::string>> restored_elements;
-            std::set<std::string,std::greater<std::string>> elements;
-            std::set<std::string> products;
-            std::set<std::string> schemas;
-            std::set<std::string> schemas_flags;
-        } triggers;
+        details::RecalculationTriggers triggers;
+        // false - пересчеты выполняются здесь же перед коммитом, иначе после коммита уходят в фоновую очередь
+        bool deferred = true;
+        // пачка фоновой очереди: цели, снова поставленные в очередь, пропускаются
+        bool queued = false;
+        // изменения моделей схем этой транзакции и построенные по ним модели, видны только ей
+        details::RbdModelChanges rbd_changes;
+        std::map<std::string, PdmService::RbdProgramPtr> rbd_programs;
+        // прочитанные этой транзакцией суммы интенсивностей детей
+        std::map<std::string, details::ChildRatesSum> child_rates;
+        // вызывается только после успешного коммита собственной транзакции
+        void afterCommit(){
+            if(!rbd_changes.empty()){
+                PdmSvc.publishRbdModels(rbd_changes);
+            }
+            rbd_changes = {};
+            rbd_programs.clear();
+            child_rates.clear();
+            // фоновая задача должна видеть уже закоммиченные изменения
+            if(deferred && !triggers.empty()){
+                PdmSvc.enqueueRecalculation(m_initiatingService,sessionPtr,triggers);
+            }
+        }
+        void dropSuperseded(){
+            if(queued) PdmSvc.dropSupersededRecalculations(triggers);
+        }
+        // транзакцию коммитит внешний контекст, момент ее коммита неизвестен
+        void afterWrappedMethod(){
+            if(!rbd_changes.empty()){
+                PdmSvc.unsettleRbdModels(rbd_changes);
+            }
+            rbd_changes = {};
+            rbd_programs.clear();
+            child_rates.clear();
+        }
         virtual void beforeCommit(boost::system::error_code &ec, const net::yield_context &yield) override{
             boost::ignore_unused(ec,yield);
+            if(deferred) return;
             //elements restored
+            dropSuperseded();
             for(const auto &element:triggers.restored_elements){
                 PdmSvc.recalculateRestoredElement(m_initiatingService,element,sessionPtr,ec,yield,shared_from_this());
             }
             //elements
+            dropSuperseded();
             for(const auto &element:triggers.elements){
                 boost::system::error_code tec;
                 std::optional<std::int32_t> lang;
@@ -161,6 +1057,7 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             }
             triggers.elements.clear();
             // products
+            dropSuperseded();
             for(const auto &product:triggers.products){
                 boost::system::error_code tec;
                 std::optional<std::int32_t> lang;
@@ -171,18 +1068,29 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
 
             }
             triggers.products.clear();
-            //schemas
-            for(const auto &schema:triggers.schemas){
-                boost::system::error_code tec;
-                std::optional<std::int32_t> lang;
-                auto node = PdmSvc.fetchNodeView(m_initiatingService,schema,lang,sessionPtr,tec,yield,shared_from_this());
-                if(!node || tec) continue;
-                if(node->role != PdmRoles::RbdSchema) continue;
-                PdmSvc.recalculateRbd(m_initiatingService,schema,sessionPtr,ec,yield,shared_from_this());
+            //schemas - подсхемы пересчитываются раньше ссылающихся на них схем
+            dropSuperseded();
+            std::vector<std::vector<std::string>> levels;
+            PdmSvc.orderRbdSchemas(m_initiatingService,triggers.schemas,levels,sessionPtr,ec,yield,shared_from_this());
+            if(ec) return;
+            // пересчет схемы сам записывает ее флаги
+            std::set<std::string> recalculated;
+            for(const auto &level:levels){
+                for(const auto &schema:level){
+                    boost::system::error_code tec;
+                    std::optional<std::int32_t> lang;
+                    auto node = PdmSvc.fetchNodeView(m_initiatingService,schema,lang,sessionPtr,tec,yield,shared_from_this());
+                    if(!node || tec) continue;
+                    if(node->role != PdmRoles::RbdSchema) continue;
+                    PdmSvc.recalculateRbd(m_initiatingService,schema,sessionPtr,ec,yield,shared_from_this());
+                    if(!ec) recalculated.insert(schema);
+                }
             }
             triggers.schemas.clear();
             // schema flags
+            dropSuperseded();
             for(const auto &schema:triggers.schemas_flags){
+                if(recalculated.count(schema)) continue;
                 boost::system::error_code tec;
                 std::optional<std::int32_t> lang;
                 auto node = PdmSvc.fetchNodeView(m_initiatingService,schema,lang,sessionPtr,tec,yield,shared_from_this());
@@ -200,8 +1108,13 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         virtual void commit(boost::system::error_code &ec, const net::yield_context &yield) override {
             beforeCommit(ec,yield);
             underlying->commit(ec, yield);
+            if(!ec) afterCommit();
         }
         virtual void cancel(boost::system::error_code &ec, const net::yield_context &yield) override{
+            // изменения моделей остались внутри транзакции, общий кэш их не видел; прочитанные суммы ей больше не нужны
+            rbd_changes = {};
+            rbd_programs.clear();
+            child_rates.clear();
             underlying->cancel(ec, yield);
         }
         PdmMethodContext(lib::database::DateAccessTransactionPtr ptr,const std::size_t initiatingService, const std::shared_ptr<IWiSession> sessionPtr):underlying(std::make_shared<wi::core::MethodContext>(ptr)),m_initiatingService(initiatingService),sessionPtr(sessionPtr){}
@@ -264,6 +1177,23 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         void addSchemaFlagsTrigger(const std::string& schema){
             triggers.schemas_flags.insert(schema);
         }
+        details::RbdModelChanges &rbdChanges(){
+            return rbd_changes;
+        }
+        std::map<std::string, PdmService::RbdProgramPtr> &rbdPrograms(){
+            return rbd_programs;
+        }
+        std::map<std::string, details::ChildRatesSum> &childRates(){
+            return child_rates;
+        }
+        void recalculateInPlace(){
+            deferred = false;
+        }
+        void recalculateQueued(details::RecalculationTriggers &&pending){
+            deferred = false;
+            queued = true;
+            triggers.merge(pending);
+        }
 
         boost::system::error_code &ec() {
         }
@@ -288,7 +1218,10 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         virtual ~PdmMethodGuard(){
             if(pmc_owner && !isOwner()){
                 if(auto pmc = _to_pmc()){
+                    // внешняя транзакция еще не закоммичена, фоновая задача ее изменений бы не увидела
+                    pmc->recalculateInPlace();
                     pmc->beforeCommit(ec,yield);
+                    pmc->afterWrappedMethod();
                 }
             }
         };
@@ -323,6 +1256,12 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
                 pmc->addSchemaFlagsTrigger(element);
             }
         }
+        void recalculateQueued(details::RecalculationTriggers &&triggers){
+            auto pmc = _to_pmc();
+            if(pmc){
+                pmc->recalculateQueued(std::move(triggers));
+            }
+        }
     };
 
     #define GUARD_PDM_METHOD() PdmMethodGuard mctx(ctx,ec,yield,std::chrono::milliseconds(WI_CONFIGURATION().read_settings<size_t>(server_method_timeout)),initiatingService,sessionPtr)
@@ -410,6 +1349,116 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         return vars;
     }
 
+    // Срок службы из стереотипа изделия
+    std::optional<long double> productExpectedLifeTime(const WiPdmElementData &data) {
+        if(!data.ster.has_value()) return std::nullopt;
+        auto it = data.ster->data.find("expected_life_time");
+        if(it == data.ster->data.end()) return std::nullopt;
+        auto gen_val = std::get_if<WiValueGeneral>(&it->second.value);
+        if(gen_val == nullptr) return std::nullopt;
+        auto val = std::get_if<std::optional<long double>>(gen_val);
+        if(val == nullptr) return std::nullopt;
+        return *val;
+    }
+
+    // Переменные блока из его собственных данных, их держат в согласии с элементом fillRbdBlockVars и fillRbdBlocksVars
+    std::optional<WiPdmElementVariables> rbdBlockVars(const WiPdmRawNodeEntity &block, boost::system::error_code &ec) {
+        if(!block.entity.has_value() || !block.entity->data.has_value()) return std::nullopt;
+        WiPdmRbdBlockData data = fromJson<decltype(data)>(block.entity->data.value());
+        if(!data.variables.has_value()) return std::nullopt;
+        fillAllVars(data.variables.value(), std::nullopt, ec);
+        return data.variables;
+    }
+
+    // Точки кривой R(t) на [from, to]. Равномерная сетка сгущается там, где R заметно отходит от хорды,
+    // затем прореживается до budget точек: в каждой корзине берется точка с наибольшим треугольником (LTTB)
+    std::vector<std::pair<Number, Number>> sampleReliabilityCurve(
+            const std::function<std::vector<Number>(const std::vector<Number> &)> &evaluate,
+            const Number &from, const Number &to, std::size_t budget) {
+        std::vector<Number> ts(rbd_curve_initial_points);
+        for(std::size_t i = 0; i < ts.size(); ++i) {
+            ts[i] = from + (to - from) * Number(i) / Number(ts.size() - 1);
+        }
+        auto rs = evaluate(ts);
+        if(rs.size() != ts.size()) return {};
+
+        // refine[i] - интервал [ts[i], ts[i + 1]] надо делить
+        std::vector<bool> refine(ts.size() - 1, true);
+        for(std::size_t pass = 0; pass < rbd_curve_max_passes && ts.size() < rbd_curve_max_points; ++pass) {
+            std::vector<Number> mids;
+            for(std::size_t i = 0; i + 1 < ts.size(); ++i) {
+                if(refine[i]) mids.push_back((ts[i] + ts[i + 1]) / 2);
+            }
+            if(mids.empty()) break;
+            auto rm = evaluate(mids);
+            if(rm.size() != mids.size()) return {};
+
+            std::vector<Number> nts, nrs;
+            std::vector<bool> nrefine;
+            nts.reserve(ts.size() + mids.size());
+            nrs.reserve(ts.size() + mids.size());
+            for(std::size_t i = 0, j = 0; i < ts.size(); ++i) {
+                nts.push_back(ts[i]);
+                nrs.push_back(rs[i]);
+                if(i + 1 == ts.size()) break;
+                if(!refine[i]) {
+                    nrefine.push_back(false);
+                    continue;
+                }
+                const bool curved = abs(rm[j] - (rs[i] + rs[i + 1]) / 2) > Number(rbd_curve_tolerance);
+                nts.push_back(mids[j]);
+                nrs.push_back(rm[j]);
+                nrefine.push_back(curved);
+                nrefine.push_back(curved);
+                ++j;
+            }
+            ts = std::move(nts);
+            rs = std::move(nrs);
+            refine = std::move(nrefine);
+        }
+
+        std::vector<std::pair<Number, Number>> curve;
+        if(budget < 3 || ts.size() <= budget) {
+            curve.reserve(ts.size());
+            for(std::size_t i = 0; i < ts.size(); ++i) curve.emplace_back(ts[i], rs[i]);
+            return curve;
+        }
+        curve.reserve(budget);
+        curve.emplace_back(ts.front(), rs.front());
+        const long double bucket = static_cast<long double>(ts.size() - 2) / (budget - 2);
+        std::size_t a = 0;
+        for(std::size_t b = 0; b + 2 < budget; ++b) {
+            const auto start = static_cast<std::size_t>(b * bucket) + 1;
+            const auto end = static_cast<std::size_t>((b + 1) * bucket) + 1;
+            // вершина треугольника - среднее следующей корзины
+            const auto nstart = end;
+            const auto nend = std::min(static_cast<std::size_t>((b + 2) * bucket) + 1, ts.size());
+            long double cx = 0, cy = 0;
+            for(auto i = nstart; i < nend; ++i) {
+                cx += static_cast<long double>(ts[i]);
+                cy += static_cast<long double>(rs[i]);
+            }
+            cx /= (nend - nstart);
+            cy /= (nend - nstart);
+            const auto ax = static_cast<long double>(ts[a]);
+            const auto ay = static_cast<long double>(rs[a]);
+            std::size_t best = start;
+            long double area = -1;
+            for(auto i = start; i < end; ++i) {
+                const auto s = std::abs((ax - cx) * (static_cast<long double>(rs[i]) - ay)
+                                      - (ax - static_cast<long double>(ts[i])) * (cy - ay));
+                if(s > area) {
+                    area = s;
+                    best = i;
+                }
+            }
+            curve.emplace_back(ts[best], rs[best]);
+            a = best;
+        }
+        curve.emplace_back(ts.back(), rs.back());
+        return curve;
+    }
+
     std::pair<std::string,std::int32_t> positional_parse_data(std::string new_data){
         new_data.erase(std::remove_if(new_data.begin(),new_data.end(),isspace),new_data.end());
         auto rit1 = std::find_if_not(new_data.rbegin(),new_data.rend(),isdigit);
@@ -522,6 +1571,35 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         return semantic;
     }
 
+    // порог k-из-n не входит в WiPdmRbdGroupStartExtension: при перезаписи расширения начала группы
+    // сохраняем его и проверяем, что ветвей после правки осталось не меньше k
+    void keepRbdGroupVoting(const WiPdmRawNode &old, WiUpdatePdmNodeQuery &query, boost::system::error_code &ec){
+        if(old.role != PdmRoles::RbdGroupStart || !query.extension.has_value()) return;
+        if(old.extension.has_value() && old.extension->contains("k") && !query.extension->contains("k")) {
+            query.extension.value()["k"] = old.extension->at("k");
+        }
+        WiPdmRbdGroupVotingExtension voting = fromJson<decltype(voting)>(query.extension.value());
+        if(!voting.k.has_value() || voting.k.value() <= 1) return;
+        WiPdmRbdGroupStartExtension group = fromJson<decltype(group)>(query.extension.value());
+        if(voting.k.value() > group.outputs.size()) {
+            ec = make_error_code(error::invalid_rbd_group);
+        }
+    }
+
+    // дополняет запрос неизменяемыми полями прежней версии узла и проверяет его
+    void prepareNodeUpdate(const WiPdmRawNode &old, WiUpdatePdmNodeQuery &query, boost::system::error_code &ec){
+        if(!query.updateRole){
+            query.role = old.role;
+        }
+        if(!query.updateType){
+            query.type = old.type;
+        }
+        if(!query.updateExtension){
+            query.extension = old.extension;
+        }
+        keepRbdGroupVoting(old, query, ec);
+    }
+
     int semanticDepth(const std::string &parent, const std::string &descendant) {
         std::vector<std::string> par,des;
         splitSemantic(par, parent);
@@ -533,6 +1611,63 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         return des.size() - par.size();
     }
 
+    // роли, интенсивности которых суммируются в родителе
+    bool isRateContributor(std::int32_t role){
+        return role == PdmRoles::ElectricComponent || role == PdmRoles::Container || role == PdmRoles::ProxyComponent;
+    }
+
+    std::optional<Number> elementFailureRate(const nlohmann::json &json){
+        WiPdmElementData data = fromJson<decltype(data)>(json);
+        if(!data.variables.has_value()) return std::nullopt;
+        return data.variables->failure_rate;
+    }
+    std::optional<Number> elementFailureRate(const WiPdmRawNodeEntity &node){
+        if(!node.entity.has_value() || !node.entity->data.has_value()) return std::nullopt;
+        return elementFailureRate(node.entity->data.value());
+    }
+
+    // версия узла после записи запроса: строится из прежней, повторно из базы не читается
+    WiPdmRawNode updatedRawNode(const WiPdmRawNode &old, const WiUpdatePdmNodeQuery &query){
+        WiPdmRawNode node = old;
+        node.role = query.role;
+        node.type = query.type;
+        node.header = query.header;
+        node.description = query.description;
+        node.extension = query.extension;
+        return node;
+    }
+    WiPdmRawNodeEntity updatedRawNodeEntity(const WiPdmRawNodeEntity &old, const WiUpdatePdmNodeQuery &query){
+        WiPdmRawNodeEntity node = old;
+        node.role = query.role;
+        node.type = query.type;
+        node.header = query.header;
+        node.description = query.description;
+        node.extension = query.extension;
+        if(query.updateData && node.entity.has_value()) {
+            node.entity->data = query.data;
+        }
+        return node;
+    }
+
+    // схема, топология которой меняется при изменении узла с данной ролью
+    std::optional<std::string> rbdTopologyOwner(const std::string &semantic, std::int32_t role){
+        switch(role){
+            case PdmRoles::RbdBlock:
+            case PdmRoles::SubRbd:
+            case PdmRoles::RbdGroupStart:
+            case PdmRoles::RbdGroupEnd:
+            case PdmRoles::RbdInputNode:
+            case PdmRoles::RbdOutputNode: {
+                boost::system::error_code tec;
+                auto schema = parentSemantic(semantic, tec);
+                if(tec) return std::nullopt;
+                return schema;
+            }
+        }
+        if(role == PdmRoles::RbdSchema) return semantic;
+        return std::nullopt;
+    }
+
     bool unwrapPositional(std::vector<std::uint32_t>&target, std::string &positional){
         constexpr static const char* positionalSplitter = ".";
         std::vector<std::string> pos;
@@ -670,9 +1805,8 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         // but if you are changing it - please reference boost docs
          gauss_kronrod::weights();gauss_kronrod::abscissa();
 
-        container_update_strand     =std::make_shared<net::io_context::strand>(ios);
-        product_update_strand       =std::make_shared<net::io_context::strand>(ios);
         rbd_update_strand           =std::make_shared<net::io_context::strand>(ios);
+        m_ios = &ios;
 
         m_eventNumerator = IWiPlatform::PlatformEventNumeratorPtr(numerator);
         std::shared_ptr<MethodContextInterface> ctx = nullptr;
@@ -686,22 +1820,153 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         toMap<WiPdmStatus>(pdmStatuses, m_statuses);
 
         PlainCache.load(mctx, ec, yield, m_defaultLanguage);
+#ifdef DEBUG
+        checkRbdKnownAnswers();
+#endif
     }
 
-    void PdmService::recalculateProductFullElement(
-            std::int64_t initiatingService,
-            const WiPdmRawNodeEntity &element,
-            const std::optional<long double> timespan,
-            bool reset,
-            const std::shared_ptr<IWiSession> sessionPtr,
-            boost::system::error_code &ec,
-            const net::yield_context &yield,
-            std::shared_ptr<MethodContextInterface> ctx) const noexcept(true){
-        GUARD_PDM_METHOD();
+    void PdmService::enqueueRecalculation(std::size_t initiatingService, const std::shared_ptr<IWiSession> sessionPtr, details::RecalculationTriggers &triggers) const {
+        {
+            std::lock_guard<std::mutex> lock(m_recalculationMutex);
+            auto &batches = m_recalculation.batches;
+            // цель пересчитывается от имени последней изменившей ее сессии
+            for(auto &batch : batches) batch.triggers.subtract(triggers);
+            m_recalculation.failed.subtract(triggers);
+            batches.erase(std::remove_if(batches.begin(), batches.end(), [](const RecalculationBatch &batch) {
+                return batch.triggers.empty();
+            }), batches.end());
+            // повторяемые пачки не пополняются, что бы новые цели не делили их попытки
+            auto it = std::find_if(batches.begin(), batches.end(), [&](const RecalculationBatch &batch) {
+                return batch.attempts == 0 && batch.sessionPtr == sessionPtr && batch.initiatingService == initiatingService;
+            });
+            if(it == batches.end()) {
+                it = batches.insert(batches.end(), RecalculationBatch{initiatingService, sessionPtr, {}, 0});
+            }
+            it->triggers.merge(triggers);
+            if(m_recalculation.scheduled) return;
+            m_recalculation.scheduled = true;
+        }
+        // одна задача за раз: пока она считает, новые цели копятся и забираются следующим кругом
+        net::spawn(*rbd_update_strand, [this](net::yield_context yield){
+            net::steady_timer timer(*m_ios);
+            while(true){
+                boost::system::error_code ec;
+                timer.expires_after(std::chrono::milliseconds(rbd_recalculation_debounce));
+                timer.async_wait(yield[ec]);
+
+                std::vector<RecalculationBatch> pending;
+                {
+                    std::lock_guard<std::mutex> lock(m_recalculationMutex);
+                    if(m_recalculation.batches.empty()){
+                        m_recalculation.scheduled = false;
+                        return;
+                    }
+                    pending.swap(m_recalculation.batches);
+                }
+                for(auto &batch : pending){
+                    ec = boost::system::error_code();
+                    recalculateTriggers(batch.initiatingService,details::RecalculationTriggers(batch.triggers),batch.sessionPtr,ec,yield);
+                    if(!ec){
+                        WI_LOG_DEBUG() << "BACKGROUND RECALCULATION DONE";
+                        notifyRecalculation(batch, false, yield);
+                        continue;
+                    }
+                    if(++batch.attempts >= rbd_recalculation_attempts){
+                        WI_LOG_ERROR() << "BACKGROUND RECALCULATION FAILED " << ec.what();
+                        // цели не теряются: они ждут следующего изменения и видны через failedRecalculations
+                        {
+                            std::lock_guard<std::mutex> lock(m_recalculationMutex);
+                            for(const auto &queued : m_recalculation.batches) batch.triggers.subtract(queued.triggers);
+                            auto targets = batch.triggers;
+                            m_recalculation.failed.merge(targets);
+                        }
+                        notifyRecalculation(batch, true, yield);
+                        continue;
+                    }
+                    WI_LOG_DEBUG() << "BACKGROUND RECALCULATION FAILED, RETRYING " << ec.what();
+                    // транзакция пачки отменена, ее цели возвращаются в очередь, кроме уже поставленных заново
+                    std::lock_guard<std::mutex> lock(m_recalculationMutex);
+                    for(const auto &queued : m_recalculation.batches) batch.triggers.subtract(queued.triggers);
+                    if(!batch.triggers.empty()){
+                        m_recalculation.batches.push_back(std::move(batch));
+                    }
+                }
+            }
+        });
+    }
 
-        if (!element.entity.has_value()){
-            ec = make_error_code(error::element_invalid);
-            return;
+    void PdmService::notifyRecalculation(const RecalculationBatch &batch, bool failed, const net::yield_context &yield) const {
+        std::size_t initiatingService = batch.initiatingService;
+        auto sessionPtr = batch.sessionPtr;
+        std::shared_ptr<MethodContextInterface> ctx = nullptr;
+        boost::system::error_code ec;
+        {
+            GUARD_PDM_METHOD();
+            auto notify = [&](const std::string &semantic){
+                boost::system::error_code tec;
+                auto node = fetchRawNode(initiatingService, semantic, sessionPtr, tec, yield, mctx);
+                if(tec || !node) return;
+                std::string parent = parentSemantic(semantic, tec);
+                if(tec) return;
+                IWiPlatform::PdmUpdateNodeEvent event(m_eventNumerator);
+                // значения неудачно пересчитанной цели устарели, клиенты должны перечитать узел
+                event.clearCached = failed;
+                event.time_point = std::chrono::system_clock::now();
+                event.initiator = initiatingService;
+                event.userid = sessionPtr->userId();
+                event.parent = parent;
+                event.semantic = semantic;
+                event.filter = Filter::filterOn;
+                event.dataChanged = false;
+                event.newNode = std::make_optional<WiPdmRawNode>(std::move(*node));
+                mctx.fire(std::forward<IWiPlatform::PdmUpdateNodeEvent>(event));
+            };
+            for(const auto &semantic : batch.triggers.restored_elements) notify(semantic);
+            for(const auto &semantic : batch.triggers.elements) notify(semantic);
+            for(const auto &semantic : batch.triggers.products) notify(semantic);
+            for(const auto &semantic : batch.triggers.schemas) notify(semantic);
+            for(const auto &semantic : batch.triggers.schemas_flags) notify(semantic);
+        }
+        if(ec) WI_LOG_ERROR() << "BACKGROUND RECALCULATION NOTIFY FAILED " << ec.what();
+    }
+
+    details::RecalculationTriggers PdmService::failedRecalculations() const {
+        std::lock_guard<std::mutex> lock(m_recalculationMutex);
+        return m_recalculation.failed;
+    }
+
+    void PdmService::dropSupersededRecalculations(details::RecalculationTriggers &triggers) const {
+        std::lock_guard<std::mutex> lock(m_recalculationMutex);
+        for(const auto &batch : m_recalculation.batches) triggers.subtract(batch.triggers);
+    }
+
+    void PdmService::recalculateTriggers(
+            std::size_t initiatingService,
+            details::RecalculationTriggers &&triggers,
+            const std::shared_ptr<IWiSession> sessionPtr,
+            boost::system::error_code &ec,
+            const net::yield_context &yield,
+            std::shared_ptr<MethodContextInterface> ctx) const noexcept(true){
+        GUARD_PDM_METHOD();
+        // собственная транзакция: цели пересчитываются по данным на момент коммита задачи и
+        // записываются ее же коммитом, все порожденные пересчеты выполняются в нем же
+        mctx.recalculateQueued(std::move(triggers));
+    }
+
+    void PdmService::recalculateProductFullElement(
+            std::int64_t initiatingService,
+            const WiPdmRawNodeEntity &element,
+            const std::optional<long double> timespan,
+            bool reset,
+            const std::shared_ptr<IWiSession> sessionPtr,
+            boost::system::error_code &ec,
+            const net::yield_context &yield,
+            std::shared_ptr<MethodContextInterface> ctx) const noexcept(true){
+        GUARD_PDM_METHOD();
+
+        if (!element.entity.has_value()){
+            ec = make_error_code(error::element_invalid);
+            return;
         }
         if (!element.entity->data.has_value()){
             ec = make_error_code(error::element_invalid);
@@ -831,14 +2096,7 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             }
         }
 
-        WiPdmRawNodeEntity::Container nodes;
-        fetchRawNodesEntity(initiatingService,product,nodes,sessionPtr,ec,yield,mctx);
-        if(ec)return;
-        for(const auto&node:nodes){
-            recalculateProductFullLayer(initiatingService,node,timespan,sessionPtr,ec,yield,mctx);
-            if(ec) return;
-        }
-        recalculateProduct(initiatingService,prod->semantic,sessionPtr,ec,yield,mctx);
+        recalculateProductTree(initiatingService,*prod,timespan,sessionPtr,ec,yield,mctx);
         if(ec) return;
 
         // recalculate all schemas
@@ -852,6 +2110,128 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             mctx.addSchemaTrigger(schema);
         }
     }
+    std::optional<Number> PdmService::childRatesSum(
+            std::int64_t initiatingService,
+            const std::string &parent,
+            const std::shared_ptr<IWiSession> sessionPtr,
+            boost::system::error_code &ec,
+            const net::yield_context &yield,
+            std::shared_ptr<MethodContextInterface> ctx) const noexcept(true){
+        GUARD_PDM_METHOD();
+        std::optional<Number> sum;
+        if(cachedChildRates(parent, sum, mctx)) return sum;
+
+        WiPdmRawNodeEntity::Container nodes;
+        fetchRawNodesEntity(initiatingService,parent,nodes,sessionPtr,ec,yield,mctx);
+        if(ec) return std::nullopt;
+        std::unordered_map<std::string, Number> rates;
+        for(const auto &node:nodes){
+            if(!isRateContributor(node.role)) continue;
+            if(!node.entity.has_value()) continue;
+            if(!node.entity->data.has_value()) continue;
+            WiPdmElementData node_data = fromJson<decltype(node_data)>(node.entity->data.value());
+            if(!node_data.variables.has_value()) continue;
+            if(!node_data.variables->failure_rate.has_value()) continue;
+            rates.emplace(node.semantic, node_data.variables->failure_rate.value());
+        }
+        storeChildRates(parent, std::move(rates), mctx);
+        cachedChildRates(parent, sum, mctx);
+        return sum;
+    }
+
+    void PdmService::recalculateProductTree(
+            std::int64_t initiatingService,
+            const WiPdmRawNodeEntity &product,
+            const std::optional<long double> timespan,
+            const std::shared_ptr<IWiSession> sessionPtr,
+            boost::system::error_code &ec,
+            const net::yield_context &yield,
+            std::shared_ptr<MethodContextInterface> ctx) const noexcept(true){
+        GUARD_PDM_METHOD();
+        WiPdmRawTreeNodeEntity::Container tree;
+        fetchFlatRawTree(initiatingService,product.semantic,tree,sessionPtr,ec,yield,mctx);
+        if(ec) return;
+
+        // в расчет идут контейнеры и компоненты, у которых все предки до изделия - контейнеры.
+        // По возрастанию семантики родитель идет раньше потомков
+        std::map<std::string, std::size_t> bySemantic;
+        for(std::size_t i = 0; i < tree.size(); ++i){
+            bySemantic.emplace(tree[i].semantic, i);
+        }
+        std::set<std::string> containers{product.semantic};
+        // отсортированы лексикографически >, что бы идти от листьев к корню
+        std::map<std::string, std::size_t, std::greater<std::string>> elements;
+        for(const auto &[semantic, i]:bySemantic){
+            if(semantic == product.semantic) continue;
+            auto parent = parentSemantic(semantic, ec);
+            if(ec) return;
+            if(!containers.count(parent)) continue;
+            switch(tree[i].role){
+                case PdmRoles::Container:
+                    containers.insert(semantic);
+                    elements.emplace(semantic, i);
+                    break;
+                case PdmRoles::ElectricComponent:
+                case PdmRoles::ProxyComponent:
+                    elements.emplace(semantic, i);
+                    break;
+            }
+        }
+
+        // сумма интенсивностей рассчитанных детей каждого контейнера и изделия
+        std::unordered_map<std::string, Number> rates;
+        std::vector<WiUpdatePdmNodeQuery> updates;
+        auto update = [&updates](const std::string &semantic, const WiPdmElementData &data, const nlohmann::json &before){
+            auto after = toJson(data);
+            if(after == before) return;
+            WiUpdatePdmNodeQuery q;
+            q.semantic = semantic;
+            q.data = std::move(after);
+            q.updateData = true;
+            updates.push_back(std::move(q));
+        };
+        for(const auto &[semantic, i]:elements){
+            const auto &element = tree[i];
+            if(!element.entity.has_value() || !element.entity->data.has_value()){
+                ec = make_error_code(error::element_invalid);
+                return;
+            }
+            WiPdmElementData data = fromJson<WiPdmElementData>(element.entity->data.value());
+            const auto before = toJson(data);
+            if(element.role == PdmRoles::Container){
+                auto it = rates.find(semantic);
+                data.variables = calculateAll(it != rates.end() ? std::make_optional(it->second) : std::nullopt, timespan);
+            }else if(data.variables.has_value()){
+                data.variables->reliability = std::nullopt;
+                data.variables->failure_probability = std::nullopt;
+                fillAllVars(data.variables.value(),timespan,ec);
+                if(ec) return;
+            }
+            if(data.variables.has_value() && data.variables->failure_rate.has_value()){
+                auto parent = parentSemantic(semantic, ec);
+                if(ec) return;
+                auto [it, inserted] = rates.try_emplace(parent, 0_Nr);
+                it->second += data.variables->failure_rate.value();
+            }
+            update(semantic, data, before);
+        }
+
+        WiPdmElementData data;
+        if(product.entity.has_value() && product.entity->data.has_value()){
+            data = fromJson<decltype(data)>(product.entity->data.value());
+        }
+        const auto before = toJson(data);
+        if(auto it = rates.find(product.semantic); it != rates.end()){
+            data.variables = calculateAll(it->second, timespan);
+        }else{
+            WI_LOG_INFO() << "product is not calculated";
+            data.variables = WiPdmElementVariables();
+        }
+        update(product.semantic, data, before);
+
+        updateNodes(initiatingService,updates,sessionPtr,Filter::filterOn,ec,yield,mctx);
+    }
+
     void PdmService::recalculateProduct(
             std::int64_t initiatingService,
             const std::string &product,
@@ -872,27 +2252,12 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         }
         
         WiUpdatePdmNodeQuery updateQueryProduct(*product_node);
-        Number failure_rate = 0_Nr;
-        bool calculated = false;
-        WiPdmRawNodeEntity::Container nodes;
-        fetchRawNodesEntity(initiatingService,product_node->semantic, nodes,sessionPtr,ec,yield,mctx);
-        for(const auto &node: nodes){
-            if(node.role != PdmRoles::ProxyComponent &&
-               node.role != PdmRoles::Container && node.role != PdmRoles::ElectricComponent){
-                continue;
-            }
-            if(!node.entity.has_value()) continue;
-            if(!node.entity->data.has_value()) continue;
-            WiPdmElementData node_data = fromJson<decltype(node_data)>(node.entity->data.value());
-            if(!node_data.variables.has_value()) continue;
-            if(!node_data.variables->failure_rate.has_value()) continue;
-            failure_rate += node_data.variables->failure_rate.value();
-            calculated = true;
-        }
+        auto failure_rate = childRatesSum(initiatingService,product_node->semantic,sessionPtr,ec,yield,mctx);
+        if(ec) return;
 
         WiPdmElementVariables vars;
         std::optional<long double> timespan;
-        if(!calculated) {
+        if(!failure_rate.has_value()) {
             WI_LOG_INFO() << "product is not calculated";
         } else {
             if(data.ster.has_value()){
@@ -961,87 +2326,99 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
 
         WiUpdatePdmNodeQuery updateQueryRbd(*rbd_node);
 
-        auto start = nodeNearestDescendant(initiatingService, rbd, PdmRoles::RbdInputNode, 1, sessionPtr, ec, yield, mctx);
-        if(ec){
-            WI_LOG_DEBUG() <<"RBD RECALCULATION FAILED " << ec.what();
-            return;
-        }
-
-        auto end = nodeNearestDescendant(initiatingService, rbd, PdmRoles::RbdOutputNode, 1, sessionPtr, ec, yield, mctx);
-        if(ec){
-            WI_LOG_DEBUG() <<"RBD RECALCULATION FAILED " << ec.what();
-            return;
-        }
+        // За один проход по элементам схемы обновляем переменные блоков, интенсивности подсхем в кэше и собираем флаги схемы
+        WiPdmRbdExtensionFlags flags;
+        flags.contains_duplicates = false;
+        flags.empty_blocks = false;
+        flags.blocks_w_elements_wo_parameters = false;
+        std::set<std::string> refs;
+        std::map<std::string, std::optional<WiPdmElementVariables>> subVars;
+        std::vector<std::shared_ptr<WiPdmRawNodeEntity>> bound;
 
-        // Обновляем переменные блоков схемы
-        std::vector<std::string> container;
-        DataAccessConst().fetchPdmPaginatedView(container, rbd, {PdmRoles::RbdBlock}, 0, 0, std::numeric_limits<std::int64_t>::max(), mctx, ec, yield);
-        for (const auto &rbdBlockSemantic : container) {
-            auto rbdBlockNode = fetchRawNode(initiatingService, rbdBlockSemantic, sessionPtr,ec, yield,mctx);
-            if (ec) continue;
-            if (rbdBlockNode->extension.has_value()) {
-                const auto extension = fromJson<WiPdmRbdBlockExtension>(rbdBlockNode->extension.value());
-                if (extension.ref.has_value()) {
-                    fillRbdBlockVars(initiatingService, extension.ref.value(), rbdBlockSemantic, sessionPtr, ec, yield, mctx);
+        WiPdmRawNodeEntity::Container nodes;
+        fetchRawNodesEntity(initiatingService, rbd, nodes, sessionPtr, ec, yield, mctx);
+        if(ec) return;
+        while(!nodes.empty()) {
+            auto node = std::make_shared<WiPdmRawNodeEntity>(std::move(nodes.back()));
+            nodes.pop_back();
+            if(node->role == PdmRoles::RbdBlock) {
+                if(!node->extension.has_value()) {
+                    flags.empty_blocks = true;
+                    continue;
+                }
+                const auto decoded = rbdExtension(node);
+                const auto &extension = std::get<WiPdmRbdBlockExtension>(*decoded);
+                if(!extension.ref.has_value()) {
+                    flags.empty_blocks = true;
+                    continue;
+                }
+                // элементы блоков читаются один раз в fillRbdBlocksVars, там же выставляется флаг параметров
+                bound.push_back(node);
+                if(!refs.insert(extension.ref.value()).second) {
+                    flags.contains_duplicates = true;
                 }
             }
+            else if(node->role == PdmRoles::SubRbd) {
+                if(!node->extension.has_value()) {
+                    flags.empty_blocks = true;
+                    invalidateRbdModel(rbd, mctx);
+                    continue;
+                }
+                const auto decoded = rbdExtension(node);
+                const auto &extension = std::get<WiPdmSubRbdExtension>(*decoded);
+                if(!extension.ref.has_value()) {
+                    flags.empty_blocks = true;
+                    patchRbdModelLeaf(rbd, node->semantic, std::nullopt, mctx);
+                    continue;
+                }
+                // повторная подсхема на ту же схему берет уже прочитанные переменные, флаги по ней уже выставлены
+                auto known = subVars.find(extension.ref.value());
+                if(known != subVars.end()) {
+                    flags.contains_duplicates = true;
+                    patchRbdModelLeaf(rbd, node->semantic, known->second.has_value() ? known->second->failure_rate : std::nullopt, mctx);
+                    continue;
+                }
+                if(!refs.insert(extension.ref.value()).second) {
+                    flags.contains_duplicates = true;
+                }
+                std::optional<long double> ts;
+                auto sv = getSubRbdRefSchemaVars(initiatingService, node, ts, sessionPtr, ec, yield, mctx);
+                if(ec) return;
+                patchRbdModelLeaf(rbd, node->semantic, sv.has_value() ? sv->failure_rate : std::nullopt, mctx);
+                if(!sv.has_value() || !sv->reliability.has_value() || !sv->failure_probability.has_value()) {
+                    flags.subs_w_not_calculated_schemas = true;
+                }
+                subVars.emplace(extension.ref.value(), std::move(sv));
+            }
         }
+        // Время работы схемы - свое или изделия проекта, от него считаются переменные блоков
+        auto timespan = getRbdTimespan(initiatingService, rbd_node, sessionPtr, ec, yield, mctx);
+        if(ec) return;
 
-        WiRbdChain chain;
-        chain.source = start.semantic;
-        chain.target = end.semantic;
+        // Переменные блоков считаются в памяти, записываются только изменившиеся
+        bool withoutParameters = false;
+        fillRbdBlocksVars(initiatingService, rbd_node, bound, timespan, withoutParameters, sessionPtr, ec, yield, mctx);
+        if(ec) return;
+        flags.blocks_w_elements_wo_parameters = withoutParameters;
 
         WiPdmElementVariables vars;
-        std::optional<long double> timespan;
 
-        WiPdmRbdExtension rbd_schemaExt = fromJson<decltype(rbd_schemaExt)>(rbd_node->extension.value());
-        if(rbd_schemaExt.expected_life_time.has_value())
-        {
-            timespan = rbd_schemaExt.expected_life_time.value();
+        std::optional<RbdModel> model;
+        RbdModelStamp stamp;
+        if(auto program = getRbdProgram(initiatingService, rbd, stamp, sessionPtr, ec, yield, mctx); program) {
+            model.emplace(program);
         }
-        else
-        {
-            boost::system::error_code tec;
-            auto proj_node = nodeNearestAncestor(initiatingService, rbd_node->semantic, PdmRoles::Project, 1, sessionPtr, ec, yield, mctx);
-            if(!tec) {
-                auto prod_node_ = nodeNearestDescendant(initiatingService,
-                                                        proj_node.semantic,
-                                                        PdmRoles::Product,
-                                                        1,
-                                                        sessionPtr,
-                                                        ec,
-                                                        yield,
-                                                        mctx);
-                auto prod_node = fetchRawNodeEntity(initiatingService,prod_node_.semantic, sessionPtr, ec, yield, mctx);
-                if (!tec) {
-                    WiPdmElementData prod_data;
-                    if(prod_node->entity.has_value()){
-                        if(prod_node->entity->data.has_value()){
-                            prod_data = fromJson<decltype(prod_data)>(prod_node->entity->data.value());
-                        }
-                    }
-                    if (prod_data.ster.has_value()) {
-                        auto it = prod_data.ster->data.find("expected_life_time");
-                        if (it != prod_data.ster->data.end()) {
-                            auto gen_val = std::get_if<WiValueGeneral>(&it->second.value);
-                            if (gen_val != nullptr) {
-                                auto val = std::get_if<std::optional<long double>>(gen_val);
-                                if (val != nullptr) {
-                                    timespan = *val;
-                                }
-                            }
-                        }
-                    }
-                }
-            }
+        if(ec){
+            WI_LOG_DEBUG() <<"RBD RECALCULATION FAILED " << ec.what();
+            return;
         }
-        boost::system::error_code tec;
-        auto model = getRbdChainModel(initiatingService, chain, sessionPtr, tec, yield, mctx);
         if(model.has_value()){
-            auto m = RbdModel(details::RBDPartModel(std::move(model.value())));
+            auto &m = model.value();
             if(timespan.has_value()) {
                 Number ts = Number(timespan.value());
-                vars.reliability = m.calculate(ts);
+                vars.reliability = m.reliability(ts);
+                // вместе со значениями операций для пересчета от измененного листа
+                storeRbdModel(rbd, stamp, std::make_shared<const details::RbdProgram>(m.program()), mctx);
                 if(vars.reliability.has_value()) {
                     Number reliability = vars.reliability.value();
                     // Если под интегральное выражение равно единице, средняя наработка бесконечна
@@ -1052,12 +2429,15 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
                     else if(0_Nr == reliability) {
                         vars.MTBF = 0_Nr;
                     }
-                    // Иначе берем интеграл
+                    // Иначе берем интеграл, по возможности точно
+                    else if(auto mtbf = m.integrate(rbd_closed_form_max_terms); mtbf.has_value()) {
+                        vars.MTBF = mtbf;
+                    }
                     else {
                         // the commented out part is number of iterations and error tolerance(target)
                         //
                         auto f = [&m](Number t) {
-                            auto r = m.calculate(t);
+                            auto r = m.calculate(t, rbd_fast_path_tolerance);
                             if (r.has_value()) {
                                 if (isfinite(r.value())) {
                                     return r.value();
@@ -1093,6 +2473,18 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         updateQueryRbd.data = toJson(data);
         updateQueryRbd.updateData = true;
 
+        WiPdmRbdExtension ext;
+        if(rbd_node->extension.has_value()){
+            ext = fromJson<WiPdmRbdExtension>(rbd_node->extension.value());
+        }
+        // расширение с теми же флагами не перезаписываем
+        auto before = toJson(ext);
+        ext.flags = flags;
+        if(toJson(ext) != before) {
+            updateQueryRbd.extension = toJson(ext);
+            updateQueryRbd.updateExtension = true;
+        }
+
         updateNode(initiatingService,updateQueryRbd,sessionPtr,Filter::filterOn,ec,yield,mctx);
         if(ec){
             WI_LOG_DEBUG() <<"RBD RECALCULATION FAILED " << ec.what();
@@ -1101,6 +2493,300 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         WI_LOG_DEBUG() <<"RBD SUCCESSFULLY RECALCULATED";
     }
 
+    std::optional<long double> PdmService::getRbdTimespan(
+            std::size_t initiatingService,
+            std::shared_ptr<WiPdmRawNodeEntity> schema,
+            const std::shared_ptr<IWiSession> sessionPtr,
+            boost::system::error_code &ec,
+            const net::yield_context &yield,
+            std::shared_ptr<MethodContextInterface> ctx) const noexcept(true){
+        GUARD_PDM_METHOD();
+        std::optional<long double> timespan;
+
+        if(schema->extension.has_value()) {
+            WiPdmRbdExtension rbd_schemaExt = fromJson<decltype(rbd_schemaExt)>(schema->extension.value());
+            if(rbd_schemaExt.expected_life_time.has_value()) {
+                return rbd_schemaExt.expected_life_time.value();
+            }
+        }
+        // схема вне проекта или проект без изделия - наследовать срок службы не от кого
+        boost::system::error_code tec;
+        auto proj_node = nodeNearestAncestor(initiatingService, schema->semantic, PdmRoles::Project, 1, sessionPtr, tec, yield, mctx);
+        if(tec) return timespan;
+        auto prod_node_ = nodeNearestDescendant(initiatingService,
+                                                proj_node.semantic,
+                                                PdmRoles::Product,
+                                                1,
+                                                sessionPtr,
+                                                tec,
+                                                yield,
+                                                mctx);
+        if(tec) return timespan;
+        auto prod_node = fetchRawNodeEntity(initiatingService,prod_node_.semantic, sessionPtr, ec, yield, mctx);
+        if(ec) return std::nullopt;
+        if(!prod_node) {
+            ec = make_error_code(error::node_not_found);
+            return std::nullopt;
+        }
+        WiPdmElementData prod_data;
+        if(prod_node->entity.has_value()){
+            if(prod_node->entity->data.has_value()){
+                prod_data = fromJson<decltype(prod_data)>(prod_node->entity->data.value());
+            }
+        }
+        return productExpectedLifeTime(prod_data);
+    }
+
+    PdmService::RbdProgramPtr PdmService::getRbdProgram(
+            std::size_t initiatingService,
+            const std::string &schema,
+            RbdModelStamp &stamp,
+            const std::shared_ptr<IWiSession> sessionPtr,
+            boost::system::error_code &ec,
+            const net::yield_context &yield,
+            std::shared_ptr<MethodContextInterface> ctx) const noexcept(true){
+        GUARD_PDM_METHOD();
+        if(auto program = cachedRbdModel(schema, stamp, mctx); program) {
+            return program;
+        }
+
+        auto graph = getRbdGraph(initiatingService, schema, sessionPtr, ec, yield, mctx);
+        if(ec || !graph) return nullptr;
+
+        auto start = details::RbdGraph::none;
+        auto end = details::RbdGraph::none;
+        for(std::uint32_t i = 0; i < graph->nodes.size(); ++i) {
+            if(graph->nodes[i]->role == PdmRoles::RbdInputNode) start = i;
+            if(graph->nodes[i]->role == PdmRoles::RbdOutputNode) end = i;
+        }
+        if(start == details::RbdGraph::none || end == details::RbdGraph::none) {
+            ec = make_error_code(error::node_not_found);
+            return nullptr;
+        }
+
+        // ошибка в цепочке не ошибка расчета - у схемы просто нет модели
+        boost::system::error_code tec;
+        auto model = getRbdChainModel(initiatingService, graph.value(), start, end, sessionPtr, tec, yield, mctx);
+        if(!model.has_value()) return nullptr;
+
+        RbdModel m(details::RBDPartModel(std::move(model.value())));
+        auto program = std::make_shared<const details::RbdProgram>(m.release());
+        storeRbdModel(schema, stamp, program, mctx);
+        return program;
+    }
+
+    std::optional<WiRbdImportanceResult> PdmService::getRbdImportance(
+            std::size_t initiatingService,
+            const WiSemanticOnlyQuery &query,
+            const std::shared_ptr<IWiSession> sessionPtr,
+            boost::system::error_code &ec,
+            const net::yield_context &yield,
+            std::shared_ptr<MethodContextInterface> ctx) const noexcept(true){
+        GUARD_PDM_METHOD();
+        auto rbd_node = fetchRawNodeEntity(initiatingService, query.semantic, sessionPtr, ec, yield, mctx);
+        if(ec || !rbd_node) return std::nullopt;
+        if(rbd_node->role != PdmRoles::RbdSchema) {
+            ec = make_error_code(error::invalid_node_role);
+            return std::nullopt;
+        }
+
+        auto timespan = getRbdTimespan(initiatingService, rbd_node, sessionPtr, ec, yield, mctx);
+        if(ec) return std::nullopt;
+        if(!timespan.has_value()) {
+            ec = make_error_code(error::no_input_data);
+            return std::nullopt;
+        }
+
+        RbdModelStamp stamp;
+        auto program = getRbdProgram(initiatingService, query.semantic, stamp, sessionPtr, ec, yield, mctx);
+        if(ec) return std::nullopt;
+
+        WiRbdImportanceResult result;
+        if(!program) return result;
+
+        RbdModel m(program);
+        const Number ts = Number(timespan.value());
+        std::vector<Number> birnbaum;
+        result.reliability = m.importance(ts, birnbaum);
+        if(!result.reliability.has_value()) return result;
+        const Number unreliability = 1_Nr - result.reliability.value();
+
+        const auto &p = m.program();
+        result.blocks.reserve(p.leaves->size());
+        for(std::size_t slot = 0; slot < p.leaves->size(); ++slot) {
+            WiRbdBlockImportance block;
+            block.semantic = (*p.leaves)[slot];
+            block.reliability = (p.rates[slot] == 0_Nr) ? 1_Nr : Number(exp(-p.rates[slot] * ts));
+            block.birnbaum = birnbaum[slot];
+            // доля отказов схемы, вызванных отказом блока
+            if(unreliability != 0_Nr) {
+                block.criticality = birnbaum[slot] * (1_Nr - block.reliability) / unreliability;
+            }
+            result.blocks.push_back(std::move(block));
+        }
+        return result;
+    }
+
+    std::optional<WiReliabilityCurveResult> PdmService::getReliabilityCurve(
+            std::size_t initiatingService,
+            const WiReliabilityCurveQuery &query,
+            const std::shared_ptr<IWiSession> sessionPtr,
+            boost::system::error_code &ec,
+            const net::yield_context &yield,
+            std::shared_ptr<MethodContextInterface> ctx) const noexcept(true){
+        GUARD_PDM_METHOD();
+        if(!(query.from >= 0) || !(query.to > query.from)) {
+            ec = make_error_code(error::invalid_input_data);
+            return std::nullopt;
+        }
+        const auto budget = std::max<std::uint32_t>(query.points.value_or(rbd_curve_default_points), 3);
+
+        auto node = fetchRawNodeEntity(initiatingService, query.semantic, sessionPtr, ec, yield, mctx);
+        if(ec || !node) return std::nullopt;
+
+        WiReliabilityCurveResult result;
+        std::function<std::vector<Number>(const std::vector<Number> &)> evaluate;
+        std::optional<RbdModel> model;
+        switch(node->role) {
+            case PdmRoles::RbdSchema: {
+                RbdModelStamp stamp;
+                auto program = getRbdProgram(initiatingService, query.semantic, stamp, sessionPtr, ec, yield, mctx);
+                if(ec) return std::nullopt;
+                if(!program) return result;
+                model.emplace(program);
+                evaluate = [&model](const std::vector<Number> &ts) { return model->calculate(ts); };
+                break;
+            }
+            case PdmRoles::Product: {
+                // интенсивность изделия уже рассчитана, R(t) = exp(-fr*t)
+                if(!node->entity.has_value() || !node->entity->data.has_value()) return result;
+                WiPdmElementData data = fromJson<decltype(data)>(node->entity->data.value());
+                if(!data.variables.has_value() || !data.variables->failure_rate.has_value()) return result;
+                const Number fr = data.variables->failure_rate.value();
+                evaluate = [fr](const std::vector<Number> &ts) {
+                    std::vector<Number> rs(ts.size());
+                    std::transform(ts.begin(), ts.end(), rs.begin(), [&fr](const Number &t) { return Number(exp(-fr * t)); });
+                    return rs;
+                };
+                break;
+            }
+            default:
+                ec = make_error_code(error::invalid_node_role);
+                return std::nullopt;
+        }
+
+        auto curve = sampleReliabilityCurve(evaluate, Number(query.from), Number(query.to), budget);
+        result.points.reserve(curve.size());
+        for(auto &[t, r]:curve) {
+            WiReliabilityCurvePoint point;
+            point.time = std::move(t);
+            point.reliability = std::move(r);
+            result.points.push_back(std::move(point));
+        }
+        return result;
+    }
+
+    std::optional<WiRbdCutSetsResult> PdmService::getRbdCutSets(
+            std::size_t initiatingService,
+            const WiRbdCutSetsQuery &query,
+            const std::shared_ptr<IWiSession> sessionPtr,
+            boost::system::error_code &ec,
+            const net::yield_context &yield,
+            std::shared_ptr<MethodContextInterface> ctx) const noexcept(true){
+        GUARD_PDM_METHOD();
+        auto rbd_node = fetchRawNodeEntity(initiatingService, query.semantic, sessionPtr, ec, yield, mctx);
+        if(ec || !rbd_node) return std::nullopt;
+        if(rbd_node->role != PdmRoles::RbdSchema) {
+            ec = make_error_code(error::invalid_node_role);
+            return std::nullopt;
+        }
+        const auto order = query.order.value_or(std::numeric_limits<std::uint32_t>::max());
+        const auto paths = query.paths.value_or(false);
+        if(order == 0) {
+            ec = make_error_code(error::invalid_input_data);
+            return std::nullopt;
+        }
+
+        RbdModelStamp stamp;
+        auto program = getRbdProgram(initiatingService, query.semantic, stamp, sessionPtr, ec, yield, mctx);
+        if(ec) return std::nullopt;
+
+        WiRbdCutSetsResult result;
+        if(!program) return result;
+        const auto &p = *program;
+
+        // модель, видимая только этой транзакции, в общий кэш сечений не попадает
+        const bool shared = !stamp.local && !stamp.unsettled;
+        RbdCutSetsPtr sets;
+        if(shared) {
+            sets = cachedRbdCutSets(query.semantic, stamp.topology, paths, order);
+        }
+        if(!sets) {
+            std::vector<std::vector<std::uint32_t>> computed;
+            // слишком много сечений - нужно ограничить порядок
+            if(!RbdCutSets::compute(p, paths, order, rbd_cut_sets_max, computed)) {
+                ec = make_error_code(error::invalid_input_data);
+                return std::nullopt;
+            }
+            sets = std::make_shared<const std::vector<std::vector<std::uint32_t>>>(std::move(computed));
+            if(shared) {
+                storeRbdCutSets(query.semantic, stamp.topology, paths, order, sets);
+            }
+        }
+
+        // переменная - компонент, на него может ссылаться несколько блоков
+        std::vector<std::vector<std::string>> varBlocks(p.varLeaves.size());
+        for(std::size_t slot = 0; slot < p.leaves->size(); ++slot) {
+            varBlocks[p.leafVars[slot]].push_back((*p.leaves)[slot]);
+        }
+        result.sets.reserve(sets->size());
+        for(const auto &vars:*sets) {
+            WiRbdCutSet set;
+            for(const auto v:vars) {
+                set.blocks.insert(set.blocks.end(), varBlocks[v].begin(), varBlocks[v].end());
+            }
+            result.sets.push_back(std::move(set));
+        }
+        return result;
+    }
+
+    void PdmService::setRbdGroupVoting(
+            std::size_t initiatingService,
+            const WiRbdGroupVotingQuery &query,
+            const std::shared_ptr<IWiSession> sessionPtr,
+            boost::system::error_code &ec,
+            const net::yield_context &yield,
+            std::shared_ptr<MethodContextInterface> ctx) const noexcept(true){
+        GUARD_PDM_METHOD();
+        auto start_node = fetchRawNodeEntity(initiatingService, query.semantic, sessionPtr, ec, yield, mctx);
+        if(ec || !start_node) return;
+        if(start_node->role != PdmRoles::RbdGroupStart) {
+            ec = make_error_code(error::not_an_rbd_group);
+            return;
+        }
+
+        std::vector<std::string> outputs;
+        getRbdElementOutputs(initiatingService, start_node, outputs, sessionPtr, ec, yield, mctx);
+        if(ec) return;
+
+        const auto k = query.k.value_or(1);
+        if(k == 0 || k > outputs.size()) {
+            ec = make_error_code(error::invalid_input_data);
+            return;
+        }
+
+        WiUpdatePdmNodeQuery update(*start_node);
+        auto extension = start_node->extension.value_or(nlohmann::json::object());
+        // k == 1 - обычный параллельный резерв, null вместо удаления, чтобы updateNode не вернул старое значение
+        extension["k"] = (k > 1) ? nlohmann::json(k) : nlohmann::json();
+        update.extension = extension;
+        update.updateExtension = true;
+        updateNode(initiatingService, update, sessionPtr, Filter::filterOn, ec, yield, mctx);
+        if(ec) return;
+
+        initiateRecalculation(initiatingService, sessionPtr, start_node->semantic, ec, yield, mctx);
+    }
+
     void PdmService::recalculateContainer(
             std::int64_t initiatingService,
             const std::string &container,
@@ -1127,39 +2813,15 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
 //        // todo: error
 //        if(!data.variables.has_value()) return;
 
-        WiPdmRawNodeEntity::Container elements;
-        fetchRawNodesEntity(initiatingService,container, elements, sessionPtr, ec, yield, mctx);
+        // сумма детей берется из индекса, сиблинги перечитываются только при его отсутствии
+        auto failure_rate = childRatesSum(initiatingService,container,sessionPtr,ec,yield,mctx);
         if(ec) return;
 
-        Number failure_rate = 0_Nr;
-        bool calculated = false;
-        for(const auto &element: elements){
-
-            // skip all beside containers, components and proxies
-            if(element.role != PdmRoles::ElectricComponent &&
-                element.role != PdmRoles::Container &&
-                element.role != PdmRoles::ProxyComponent) continue;
-
-            // todo: flag element as invalid
-            if(!element.entity.has_value()) continue;
-            if(!element.entity->data.has_value()) continue;
-
-            WiPdmElementData node_data = fromJson<decltype(data)>(element.entity->data.value());
-
-            // todo: flag element as invalid
-            if(!node_data.variables.has_value()) continue;
-            if(!node_data.variables->failure_rate.has_value()) continue;
-
-
-            failure_rate += node_data.variables->failure_rate.value();
-            calculated = true;
-        }
-
         std::optional<long double> timespan;
         WiPdmElementVariables vars;
 
         std::optional<Number> fr_result;
-        if(calculated){
+        if(failure_rate.has_value()){
             boost::system::error_code tec;
             auto prod_node_ = nodeNearestAncestor(initiatingService,
                                                     container_node->semantic,
@@ -1299,92 +2961,236 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
                 const net::yield_context &yield,
                 std::shared_ptr<MethodContextInterface> ctx) const {
             GUARD_PDM_METHOD();
-            std::int64_t nodeId = 0;
-            auto actor = std::make_optional<WiRawActorInfoPart> ({sessionPtr->userId(), std::chrono::system_clock::now()});
             auto semantic = query.semantic;
             auto rawOldNodePtr = fetchRawNode(initiatingService,semantic, sessionPtr, ec, yield, mctx);
             if(ec) return;
-            semantic = query.semantic;
+            if(!rawOldNodePtr) {
+                ec = make_error_code(code::node_not_found);
+                return;
+            }
+            auto rawOldNodeEntityPtr = fetchRawNodeEntity(initiatingService,semantic, sessionPtr, ec, yield, mctx);
+            if(ec) return;
 
-            if(!query.updateRole){
-                query.role = rawOldNodePtr->role;
+            prepareNodeUpdate(*rawOldNodePtr, query, ec);
+            if(ec) return;
+            std::set<std::string> schemas;
+            writeNodeUpdate(initiatingService, *rawOldNodePtr, query, schemas, sessionPtr, ec, yield, mctx);
+            if(ec) return;
+            for(const auto &schema:schemas){
+                invalidateRbdModel(schema, mctx);
             }
-            if(!query.updateType){
-                query.type = rawOldNodePtr->type;
+
+        std::optional<std::string> parentOpt = std::nullopt;
+        constexpr static const char* semanticSplitter = "::";
+        std::vector<std::string> semantics;
+        boost::iter_split(semantics, semantic, boost::first_finder(semanticSplitter));
+
+        if (!semantics.empty()) {
+            semantics.erase(semantics.end() -1 );
+            std::string parent;
+            if (!semantics.empty()) {
+                buildSemantic(semantics, parent);
+                parentOpt = std::make_optional<std::string>(std::move(parent));
             }
-            if(!query.updateExtension){
-                query.extension = rawOldNodePtr->extension;
         }
 
-        if (rawOldNodePtr) {
-            DataAccessConst().updatePdmNode(
-                    nodeId,
-                    query.semantic,
-                    query.role,
-                    query.type,
-                    query.header,
-                    query.description,
-                    query.data,
-                    query.updateData,
-                    query.extension,
-                    actor,
-                    mctx,
-                    ec,
-                    yield
-            );
+        IWiPlatform::PdmUpdateNodeEvent event(m_eventNumerator);
+        // prohibit cache clearing onEvent
+        // since cahce already contains current version of the node
+        event.clearCached = false;
+        event.time_point = std::chrono::system_clock::now();
+        event.initiator = initiatingService;
+        event.userid = sessionPtr->userId();
+//        event.fio = sessionPtr->getUserView();
+        event.parent = parentOpt;
+        event.semantic = semantic;
 
-            if(!ec) {
-                // force update updated node
-                auto newNodePtr = fetchRawNode(initiatingService,semantic, sessionPtr, ec, yield, mctx, true);
-                auto newNodeEntityPtr = fetchRawNodeEntity(initiatingService,semantic, sessionPtr, ec, yield, mctx);
-                if (!ec && newNodePtr) {
-                    std::optional<std::string> parentOpt = std::nullopt;
-                    constexpr static const char* semanticSplitter = "::";
-                    std::vector<std::string> semantics;
-                    boost::iter_split(semantics, semantic, boost::first_finder(semanticSplitter));
+        if (query.role == PdmRoles::Project){
+            event.filter = Filter::filterOff;
+        }
+        else{
+            event.filter = filter;
+        }
 
-                    if (!semantics.empty()) {
-                        semantics.erase(semantics.end() -1 );
-                        std::string parent;
-                        if (!semantics.empty()) {
-                            buildSemantic(semantics, parent);
-                            parentOpt = std::make_optional<std::string>(std::move(parent));
-                        }
-                    }
+        event.dataChanged = query.updateData;
+        event.newNode = std::make_optional<WiPdmRawNode>(updatedRawNode(*rawOldNodePtr, query));
+        if (rawOldNodeEntityPtr) {
+            auto newNodeEntity = updatedRawNodeEntity(*rawOldNodeEntityPtr, query);
+            if (newNodeEntity.entity.has_value())
+                event.newEntity = std::make_optional<WiPdmRawEntity>(std::move(*newNodeEntity.entity));
+        }
 
-                    IWiPlatform::PdmUpdateNodeEvent event(m_eventNumerator);
-                    // prohibit cache clearing onEvent
-                    // since cahce already contains current version of the node
-                    event.clearCached = false;
-                    event.time_point = std::chrono::system_clock::now();
-                    event.initiator = initiatingService;
-                    event.userid = sessionPtr->userId();
-//                    event.fio = sessionPtr->getUserView();
-                    event.parent = parentOpt;
-                    event.semantic = semantic;
+        event.oldNode = std::make_optional<WiPdmRawNode>(std::move(*rawOldNodePtr));
+        mctx.fire(std::forward<IWiPlatform::PdmUpdateNodeEvent>(event));
+//        initiateRecalculation(initiatingService,sessionPtr,semantic,ec,yield,mctx);
+//        if(ec) return;
+    }
 
-                    if (query.role == PdmRoles::Project){
-                        event.filter = Filter::filterOff;
-                    }
-                    else{
-                        event.filter = filter;
-                    }
+    void PdmService::writeNodeUpdate(
+            std::size_t initiatingService,
+            const WiPdmRawNode &old,
+            WiUpdatePdmNodeQuery &query,
+            std::set<std::string> &schemas,
+            const std::shared_ptr<IWiSession> sessionPtr,
+            boost::system::error_code &ec,
+            const net::yield_context &yield,
+            std::shared_ptr<MethodContextInterface> ctx) const noexcept(true) {
+        GUARD_PDM_METHOD();
+        std::int64_t nodeId = 0;
+        auto actor = std::make_optional<WiRawActorInfoPart> ({sessionPtr->userId(), std::chrono::system_clock::now()});
+        DataAccessConst().updatePdmNode(
+                nodeId,
+                query.semantic,
+                query.role,
+                query.type,
+                query.header,
+                query.description,
+                query.data,
+                query.updateData,
+                query.extension,
+                actor,
+                mctx,
+                ec,
+                yield
+        );
+        if(ec) return;
 
-                    event.dataChanged = query.updateData;
-                    event.newNode = std::make_optional<WiPdmRawNode>(std::move(*newNodePtr));
-                    if (newNodeEntityPtr)
-                        event.newEntity = std::make_optional<WiPdmRawEntity>(std::move(*newNodeEntityPtr->entity));
+        if(query.updateExtension && old.role != PdmRoles::RbdSchema) {
+            if(auto schema = rbdTopologyOwner(query.semantic, old.role); schema.has_value()) {
+                schemas.insert(schema.value());
+            }
+        }
+        // записанная версия строится из прежней и запроса, закэшированные версии узла и его слоя сбрасываются
+        dropCachedNode(query.semantic);
+        boost::system::error_code pec;
+        auto parent = parentSemantic(query.semantic, pec);
+        if(!pec) {
+            WiCacheSvc.remove<WiPdmRawNode::Container>(parent);
+            WiCacheSvc.remove<WiPdmRawNodeEntity::Container>(parent);
+        }
+        if (query.updateData) {
+            applyChildRate(query.semantic, query.role, query.data.has_value() ? elementFailureRate(query.data.value()) : std::nullopt, mctx);
+        }
+    }
 
-                    event.oldNode = std::make_optional<WiPdmRawNode>(std::move(*rawOldNodePtr));
-                    mctx.fire(std::forward<IWiPlatform::PdmUpdateNodeEvent>(event));
-                }
+    // Пакетное обновление: прежние версии читаются слоями родителей в транзакции пакета до первой записи,
+    // отсутствующий узел обрывает пакет без частичных изменений. Модели схем сбрасываются один раз на схему,
+    // о пакете сообщает одно событие по общему предку его узлов
+    void PdmService::updateNodes(
+            std::size_t initiatingService,
+            std::vector<WiUpdatePdmNodeQuery> &queries,
+            const std::shared_ptr<IWiSession> sessionPtr,
+            const Filter &filter,
+            boost::system::error_code &ec,
+            const net::yield_context &yield,
+            std::shared_ptr<MethodContextInterface> ctx) const {
+        GUARD_PDM_METHOD();
+        if(queries.empty()) return;
+        if(queries.size() == 1){
+            updateNode(initiatingService, queries.front(), sessionPtr, filter, ec, yield, mctx);
+            return;
+        }
+
+        // закэшированный слой мог устареть, поэтому слои читаются из базы мимо кэша
+        std::map<std::string, std::unordered_map<std::string, std::vector<std::size_t>>> layers;
+        std::vector<std::shared_ptr<WiPdmRawNode>> oldNodes(queries.size());
+        for(std::size_t i = 0; i < queries.size(); ++i){
+            boost::system::error_code pec;
+            auto parent = parentSemantic(queries[i].semantic, pec);
+            if(pec){
+                // у корня слоя нет
+                oldNodes[i] = fetchRawNode(initiatingService, queries[i].semantic, sessionPtr, ec, yield, mctx);
+                if(ec) return;
+                continue;
             }
+            layers[parent][queries[i].semantic].push_back(i);
         }
-        else {
-            ec = make_error_code(code::node_not_found);
+        for(auto &[parent, positions]:layers){
+            WiPdmRawNode::Container nodes;
+            fetchRawNodes(initiatingService, parent, nodes, sessionPtr, ec, yield, mctx);
+            if(ec) return;
+            for(const auto &node:nodes){
+                auto it = positions.find(node.semantic);
+                if(it == positions.end()) continue;
+                auto old = std::make_shared<WiPdmRawNode>(node);
+                for(auto i:it->second) oldNodes[i] = old;
+            }
+        }
+        for(std::size_t i = 0; i < queries.size(); ++i){
+            if(!oldNodes[i]){
+                ec = make_error_code(code::node_not_found);
+                return;
+            }
+            prepareNodeUpdate(*oldNodes[i], queries[i], ec);
+            if(ec) return;
+        }
+
+        std::set<std::string> schemas;
+        for(std::size_t i = 0; i < queries.size(); ++i){
+            writeNodeUpdate(initiatingService, *oldNodes[i], queries[i], schemas, sessionPtr, ec, yield, mctx);
+            if(ec) return;
+        }
+        for(const auto &schema:schemas){
+            invalidateRbdModel(schema, mctx);
+        }
+
+        // общий предок слоев пакета, корни в нем не участвуют
+        std::optional<std::vector<std::string>> common;
+        for(const auto &[parent, positions]:layers){
+            std::vector<std::string> parts;
+            splitSemantic(parts, parent);
+            if(!common.has_value()){
+                common = std::move(parts);
+                continue;
+            }
+            std::size_t n = 0;
+            while(n < common->size() && n < parts.size() && (*common)[n] == parts[n]) ++n;
+            common->resize(n);
+        }
+        bool dataChanged = false;
+        bool project = false;
+        for(const auto &query:queries){
+            dataChanged = dataChanged || query.updateData;
+            project = project || query.role == PdmRoles::Project;
+        }
+        auto notify = [&](const std::string &semantic, const std::shared_ptr<WiPdmRawNode> &node){
+            IWiPlatform::PdmUpdateNodeEvent event(m_eventNumerator);
+            // клиенты перечитывают узел и его слой: в кэше его версии уже нет
+            event.clearCached = true;
+            event.time_point = std::chrono::system_clock::now();
+            event.initiator = initiatingService;
+            event.userid = sessionPtr->userId();
+            boost::system::error_code pec;
+            auto parent = parentSemantic(semantic, pec);
+            if(!pec) {
+                event.parent = std::make_optional<std::string>(std::move(parent));
+            }
+            event.semantic = semantic;
+            event.filter = project ? Filter::filterOff : filter;
+            event.dataChanged = dataChanged;
+            if(node){
+                event.newNode = std::make_optional<WiPdmRawNode>(*node);
+                event.oldNode = std::make_optional<WiPdmRawNode>(*node);
+            }
+            mctx.fire(std::forward<IWiPlatform::PdmUpdateNodeEvent>(event));
+        };
+        bool hasRoots = layers.empty() || std::any_of(queries.begin(), queries.end(), [](const WiUpdatePdmNodeQuery &query){
+            boost::system::error_code pec;
+            parentSemantic(query.semantic, pec);
+            return bool(pec);
+        });
+        if(!hasRoots && common.has_value() && !common->empty()){
+            std::string ancestor;
+            buildSemantic(common.value(), ancestor);
+            boost::system::error_code aec;
+            auto node = fetchRawNode(initiatingService, ancestor, sessionPtr, aec, yield, mctx);
+            notify(ancestor, aec ? nullptr : node);
+            return;
+        }
+        // у пакета нет общего предка - сообщается о каждом узле
+        for(std::size_t i = 0; i < queries.size(); ++i){
+            notify(queries[i].semantic, std::make_shared<WiPdmRawNode>(updatedRawNode(*oldNodes[i], queries[i])));
         }
-//        initiateRecalculation(initiatingService,sessionPtr,semantic,ec,yield,mctx);
-//        if(ec) return;
     }
 
     void PdmService::deleteNode(
@@ -1408,6 +3214,13 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         if (rawOldNodePtr) {
             DataAccessConst().deletePdmNode(semantic, actor, mctx, ec, yield);
             if(!ec) {
+                applyChildRate(semantic, rawOldNodePtr->role, std::nullopt, mctx);
+                invalidateChildRates(semantic, true, mctx);
+                if(auto schema = rbdTopologyOwner(semantic, rawOldNodePtr->role); schema.has_value()) {
+                    invalidateRbdModel(schema.value(), mctx);
+                }
+                // удаление каскадное, вместе с узлом уходят расширения всех потомков
+                invalidateRbdExtension(semantic, true);
                 std::optional<std::string> parentOpt = std::nullopt;
                 constexpr static const char* semanticSplitter = "::";
                 std::vector<std::string> semantics;
@@ -1512,6 +3325,10 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
                 yield);
 
         if (!ec) {
+            if (auto schema = rbdTopologyOwner(selfSemantic, query.role); schema.has_value()) {
+                invalidateRbdModel(schema.value(), mctx);
+            }
+            invalidateChildRates(query.parent, false, mctx);
             auto rawNewNodePtr = fetchRawNode(selfSemantic, ec, yield, mctx);
             if (!ec && rawNewNodePtr) {
                 IWiPlatform::PdmAddNodeEvent event(m_eventNumerator);
@@ -1540,89 +3357,66 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         auto sessionPtr = sessionContext->getSession();
         auto &ec = mctx->ec();
 
-        std::int64_t nodeId = 0;
-        auto actor = std::make_optional<WiRawActorInfoPart> ({sessionPtr->userId(), std::chrono::system_clock::now()});
         auto semantic = query.semantic;
         auto rawOldNodePtr = fetchRawNode(initiatingService,semantic, sessionPtr, ec, yield, mctx);
         if(ec) return;
-        semantic = query.semantic;
-
-        if(!query.updateRole){
-            query.role = rawOldNodePtr->role;
-        }
-        if(!query.updateType){
-            query.type = rawOldNodePtr->type;
-        }
-        if(!query.updateExtension){
-            query.extension = rawOldNodePtr->extension;
-        }
-
-        if (rawOldNodePtr) {
-            DataAccessConst().updatePdmNode(
-                    nodeId,
-                    query.semantic,
-                    query.role,
-                    query.type,
-                    query.header,
-                    query.description,
-                    query.data,
-                    query.updateData,
-                    query.extension,
-                    actor,
-                    *mctx,
-                    ec,
-                    yield
-            );
-
-            if(!ec) {
-                // force update updated node
-                auto newNodePtr = fetchRawNode(initiatingService,semantic, sessionPtr, ec, yield, mctx, true);
-                auto newNodeEntityPtr = fetchRawNodeEntity(initiatingService,semantic, sessionPtr, ec, yield, mctx);
-                if (!ec && newNodePtr) {
-                    std::optional<std::string> parentOpt = std::nullopt;
-                    constexpr static const char* semanticSplitter = "::";
-                    std::vector<std::string> semantics;
-                    boost::iter_split(semantics, semantic, boost::first_finder(semanticSplitter));
-
-                    if (!semantics.empty()) {
-                        semantics.erase(semantics.end() -1 );
-                        std::string parent;
-                        if (!semantics.empty()) {
-                            buildSemantic(semantics, parent);
-                            parentOpt = std::make_optional<std::string>(std::move(parent));
-                        }
-                    }
-
-                    IWiPlatform::PdmUpdateNodeEvent event(m_eventNumerator);
-                    // prohibit cache clearing onEvent
-                    // since cahce already contains current version of the node
-                    event.clearCached = false;
-                    event.time_point = std::chrono::system_clock::now();
-                    event.initiator = initiatingService;
-                    event.userid = sessionPtr->userId();
-                    event.parent = parentOpt;
-                    event.semantic = semantic;
+        if(!rawOldNodePtr) {
+            ec = make_error_code(code::node_not_found);
+            return;
+        }
+        auto rawOldNodeEntityPtr = fetchRawNodeEntity(initiatingService,semantic, sessionPtr, ec, yield, mctx);
+        if(ec) return;
 
-                    if (query.role == PdmRoles::Project){
-                        event.filter = Filter::filterOff;
-                    }
-                    else{
-                        event.filter = filter;
-                    }
+        prepareNodeUpdate(*rawOldNodePtr, query, ec);
+        if(ec) return;
+        std::set<std::string> schemas;
+        writeNodeUpdate(initiatingService, *rawOldNodePtr, query, schemas, sessionPtr, ec, yield, mctx);
+        if(ec) return;
+        for(const auto &schema:schemas){
+            invalidateRbdModel(schema, mctx);
+        }
 
-                    event.dataChanged = query.updateData;
-                    event.newNode = std::make_optional<WiPdmRawNode>(std::move(*newNodePtr));
-                    if (newNodeEntityPtr)
-                        event.newEntity = std::make_optional<WiPdmRawEntity>(std::move(*newNodeEntityPtr->entity));
+        std::optional<std::string> parentOpt = std::nullopt;
+        constexpr static const char* semanticSplitter = "::";
+        std::vector<std::string> semantics;
+        boost::iter_split(semantics, semantic, boost::first_finder(semanticSplitter));
 
-                    event.oldNode = std::make_optional<WiPdmRawNode>(std::move(*rawOldNodePtr));
-                    mctx->fire(std::forward<IWiPlatform::PdmUpdateNodeEvent>(event));
-                }
+        if (!semantics.empty()) {
+            semantics.erase(semantics.end() -1 );
+            std::string parent;
+            if (!semantics.empty()) {
+                buildSemantic(semantics, parent);
+                parentOpt = std::make_optional<std::string>(std::move(parent));
             }
         }
-        else {
-            ec = make_error_code(code::node_not_found);
+
+        IWiPlatform::PdmUpdateNodeEvent event(m_eventNumerator);
+        // prohibit cache clearing onEvent
+        // since cahce already contains current version of the node
+        event.clearCached = false;
+        event.time_point = std::chrono::system_clock::now();
+        event.initiator = initiatingService;
+        event.userid = sessionPtr->userId();
+        event.parent = parentOpt;
+        event.semantic = semantic;
+
+        if (query.role == PdmRoles::Project){
+            event.filter = Filter::filterOff;
+        }
+        else{
+            event.filter = filter;
+        }
+
+        event.dataChanged = query.updateData;
+        event.newNode = std::make_optional<WiPdmRawNode>(updatedRawNode(*rawOldNodePtr, query));
+        if (rawOldNodeEntityPtr) {
+            auto newNodeEntity = updatedRawNodeEntity(*rawOldNodeEntityPtr, query);
+            if (newNodeEntity.entity.has_value())
+                event.newEntity = std::make_optional<WiPdmRawEntity>(std::move(*newNodeEntity.entity));
         }
+
+        event.oldNode = std::make_optional<WiPdmRawNode>(std::move(*rawOldNodePtr));
+        mctx->fire(std::forward<IWiPlatform::PdmUpdateNodeEvent>(event));
     }
 
     void PdmService::deleteNode(
@@ -1642,6 +3436,13 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         if (rawOldNodePtr) {
             DataAccessConst().deletePdmNode(semantic, actor, *mctx, ec, yield);
             if(!ec) {
+                applyChildRate(semantic, rawOldNodePtr->role, std::nullopt, mctx);
+                invalidateChildRates(semantic, true, mctx);
+                if(auto schema = rbdTopologyOwner(semantic, rawOldNodePtr->role); schema.has_value()) {
+                    invalidateRbdModel(schema.value(), mctx);
+                }
+                // удаление каскадное, вместе с узлом уходят расширения всех потомков
+                invalidateRbdExtension(semantic, true);
                 std::optional<std::string> parentOpt = std::nullopt;
                 constexpr static const char* semanticSplitter = "::";
                 std::vector<std::string> semantics;
@@ -2320,7 +4121,8 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             ec = make_error_code(error::invalid_rbd_element);
             return std::nullopt;
         }
-        WiPdmRbdBlockExtension extension = fromJson<decltype(extension)>(block->extension.value());
+        const auto decoded = rbdExtension(block);
+        const auto &extension = std::get<WiPdmRbdBlockExtension>(*decoded);
         if(!extension.ref.has_value()){
             return std::nullopt;
         }
@@ -2371,7 +4173,8 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             ec = make_error_code(error::invalid_rbd_element);
             return std::nullopt;
         }
-        WiPdmSubRbdExtension extension = fromJson<decltype(extension)>(sub->extension.value());
+        const auto decoded = rbdExtension(sub);
+        const auto &extension = std::get<WiPdmSubRbdExtension>(*decoded);
         if(!extension.ref.has_value()){
             return std::nullopt;
         }
@@ -2402,6 +4205,84 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         return data.variables;
     }
 
+    std::optional<details::RbdGraph> PdmService::getRbdGraph(
+            std::size_t initiatingService,
+            const std::string &schema,
+            const std::shared_ptr<IWiSession> sessionPtr,
+            boost::system::error_code &ec,
+            const net::yield_context &yield,
+            std::shared_ptr<MethodContextInterface> ctx) const noexcept(true){
+        GUARD_PDM_METHOD();
+        WiPdmRawNodeEntity::Container nodes;
+        fetchRawNodesEntity(initiatingService, schema, nodes, sessionPtr, ec, yield, mctx);
+        if(ec) return std::nullopt;
+
+        details::RbdGraph graph;
+        graph.nodes.reserve(nodes.size());
+        for(auto &node:nodes) {
+            graph.ids.emplace(node.semantic, graph.nodes.size());
+            graph.nodes.push_back(std::make_shared<WiPdmRawNodeEntity>(std::move(node)));
+        }
+
+        const auto n = static_cast<std::uint32_t>(graph.nodes.size());
+        graph.outOffsets.reserve(n + 1);
+        graph.inOffsets.reserve(n + 1);
+        graph.pairs.assign(n, details::RbdGraph::none);
+        auto link = [&graph](std::vector<std::uint32_t> &links, const std::optional<std::string> &semantic) {
+            if(semantic.has_value()) links.push_back(graph.find(semantic.value()));
+        };
+        for(std::uint32_t i = 0; i < n; ++i) {
+            graph.outOffsets.push_back(graph.outs.size());
+            graph.inOffsets.push_back(graph.ins.size());
+            const auto &node = graph.nodes[i];
+            if(!node->extension.has_value()) continue;
+            const auto decoded = rbdExtension(node);
+            switch(node->role){
+                case PdmRoles::RbdInputNode:
+                    link(graph.outs, std::get<WiPdmRbdInputNodeExtension>(*decoded).output);
+                    break;
+                case PdmRoles::RbdOutputNode:
+                    link(graph.ins, std::get<WiPdmRbdOutputNodeExtension>(*decoded).input);
+                    break;
+                case PdmRoles::RbdBlock: {
+                    const auto &extension = std::get<WiPdmRbdBlockExtension>(*decoded);
+                    link(graph.ins, extension.input);
+                    link(graph.outs, extension.output);
+                }
+                    break;
+                case PdmRoles::SubRbd: {
+                    const auto &extension = std::get<WiPdmSubRbdExtension>(*decoded);
+                    link(graph.ins, extension.input);
+                    link(graph.outs, extension.output);
+                }
+                    break;
+                case PdmRoles::RbdGroupStart: {
+                    const auto &extension = std::get<WiPdmRbdGroupStartExtension>(*decoded);
+                    link(graph.ins, extension.input);
+                    for(const auto &output:extension.outputs) {
+                        graph.outs.push_back(graph.find(output));
+                    }
+                    if(extension.end.has_value()) graph.pairs[i] = graph.find(extension.end.value());
+                }
+                    break;
+                case PdmRoles::RbdGroupEnd: {
+                    const auto &extension = std::get<WiPdmRbdGroupEndExtension>(*decoded);
+                    for(const auto &input:extension.inputs) {
+                        graph.ins.push_back(graph.find(input));
+                    }
+                    link(graph.outs, extension.output);
+                    if(extension.start.has_value()) graph.pairs[i] = graph.find(extension.start.value());
+                }
+                    break;
+                default:
+                    break;
+            }
+        }
+        graph.outOffsets.push_back(graph.outs.size());
+        graph.inOffsets.push_back(graph.ins.size());
+        return graph;
+    }
+
     std::optional<details::ReservedModelPtr> PdmService::getRbdReservedModel(
             std::size_t initiatingService,
             const WiRbdChain &query,
@@ -2410,26 +4291,48 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             const net::yield_context &yield,
             std::shared_ptr<MethodContextInterface> ctx) const noexcept(true){
         GUARD_PDM_METHOD();
-        auto start_node = fetchRawNodeEntity(initiatingService,query.source,sessionPtr,ec,yield,mctx);
-        if(ec || !start_node) return std::nullopt;
+        auto schema = parentSemantic(query.source, ec);
+        if(ec) return std::nullopt;
+        auto graph = getRbdGraph(initiatingService, schema, sessionPtr, ec, yield, mctx);
+        if(ec || !graph) return std::nullopt;
+
+        const auto start = graph->find(query.source);
+        if(start == details::RbdGraph::none) {
+            ec = make_error_code(error::node_not_found);
+            return std::nullopt;
+        }
+        return getRbdReservedModel(initiatingService, graph.value(), start, sessionPtr, ec, yield, mctx);
+    }
 
+    std::optional<details::ReservedModelPtr> PdmService::getRbdReservedModel(
+            std::size_t initiatingService,
+            const details::RbdGraph &graph,
+            std::uint32_t start,
+            const std::shared_ptr<IWiSession> sessionPtr,
+            boost::system::error_code &ec,
+            const net::yield_context &yield,
+            std::shared_ptr<MethodContextInterface> ctx) const noexcept(true){
+        GUARD_PDM_METHOD();
+        const auto &start_node = graph.nodes[start];
         if(start_node->role != PdmRoles::RbdGroupStart){
             ec = make_error_code(error::invalid_rbd_element);
             return std::nullopt;
         }
-
-        std::vector<std::string> outputs;
-        getRbdElementOutputs(initiatingService,start_node,outputs,sessionPtr,ec,yield,mctx);
-        if(ec) return std::nullopt;
+        const auto end = graph.pairs[start];
+        if(end == details::RbdGraph::none || graph.pairs[end] != start) {
+            ec = make_error_code(error::invalid_rbd_group);
+            return std::nullopt;
+        }
 
         details::ReservedModelPtr model = std::make_unique<details::ReservedModel>();
+        model->k = 1;
+        if(start_node->extension.has_value()) {
+            WiPdmRbdGroupVotingExtension voting = fromJson<decltype(voting)>(start_node->extension.value());
+            model->k = voting.k.value_or(1);
+        }
         bool calculated = false;
-        for(const auto& output: outputs){
-            WiRbdChain chain;
-            chain.source = output;
-            chain.target = query.target;
-
-            auto ch_model = getRbdChainModel(initiatingService,chain, sessionPtr,ec,yield,mctx);
+        for(std::uint32_t i = 0; i < graph.outDegree(start); ++i){
+            auto ch_model = getRbdChainModel(initiatingService, graph, graph.output(start, i), end, sessionPtr, ec, yield, mctx);
             if(ec) return std::nullopt;
 
             if(ch_model.has_value()){
@@ -2440,6 +4343,11 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         if(!calculated) {
             return std::nullopt;
         }
+        // ветви без значений в модель не входят; порог больше оставшихся ветвей - ошибка, а не понижение k
+        if(model->k > model->chains.size()) {
+            ec = make_error_code(error::invalid_rbd_group);
+            return std::nullopt;
+        }
 
         return std::make_optional(std::move(model));
     }
@@ -2453,27 +4361,54 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             std::shared_ptr<MethodContextInterface> ctx) const noexcept(true)
     {
         GUARD_PDM_METHOD();
+        auto schema = parentSemantic(query.source, ec);
+        if(ec) return std::nullopt;
+        auto graph = getRbdGraph(initiatingService, schema, sessionPtr, ec, yield, mctx);
+        if(ec || !graph) return std::nullopt;
 
-        auto start_node = fetchRawNodeEntity(initiatingService,query.source,sessionPtr, ec, yield, mctx);
-        if (ec || !start_node) return std::nullopt;
+        return getRbdChainModel(initiatingService, graph.value(), graph->find(query.source), graph->find(query.target),
+                                sessionPtr, ec, yield, mctx);
+    }
 
-        auto end_node = fetchRawNodeEntity(initiatingService,query.target,sessionPtr, ec, yield, mctx);
-        if (ec || !end_node) return std::nullopt;
+    std::optional<details::LinearModelPtr> PdmService::getRbdChainModel(
+            std::size_t initiatingService,
+            const details::RbdGraph &graph,
+            std::uint32_t source,
+            std::uint32_t target,
+            const std::shared_ptr<IWiSession> sessionPtr,
+            boost::system::error_code &ec,
+            const net::yield_context &yield,
+            std::shared_ptr<MethodContextInterface> ctx) const noexcept(true)
+    {
+        GUARD_PDM_METHOD();
+        if(source == details::RbdGraph::none || target == details::RbdGraph::none) {
+            ec = make_error_code(error::node_not_found);
+            return std::nullopt;
+        }
 
         details::LinearModelPtr model = std::make_unique<details::LinearModel>();
         bool calculated = false;
-        do {
+        auto curr = source;
+        // цепочка длиннее числа узлов схемы - в связях цикл
+        for(std::size_t steps = 0;; ++steps) {
+            if(steps > graph.nodes.size()) {
+                ec = make_error_code(error::invalid_rbd_chain);
+                return std::nullopt;
+            }
+            const auto &start_node = graph.nodes[curr];
             if (start_node->role == PdmRoles::RbdBlock) {
-                std::optional<long double> timespan;
-                auto bv = getRbdBlockElementVars(initiatingService, start_node,timespan, sessionPtr, ec, yield, mctx);
-
-                // todo: flag element and exit
+                if(!start_node->extension.has_value()) {
+                    ec = make_error_code(error::invalid_rbd_element);
+                    return std::nullopt;
+                }
+                // интенсивность берется из данных блока: элемент уже прочитан при пересчете переменных блоков
+                const auto decoded = rbdExtension(start_node);
+                const auto &extension = std::get<WiPdmRbdBlockExtension>(*decoded);
+                auto bv = extension.ref.has_value() ? rbdBlockVars(*start_node, ec) : std::nullopt;
                 if (ec) return std::nullopt;
-                if(bv.has_value()) {
-                    if(bv->failure_rate.has_value()){
-                        model->chain.push_back(details::RBDPartModel(details::Node(bv->failure_rate.value())));
-                        calculated = true;
-                    }
+                if(bv.has_value() && bv->failure_rate.has_value()) {
+                    model->chain.push_back(details::RBDPartModel(details::Node(bv->failure_rate.value(), start_node->semantic, extension.ref.value())));
+                    calculated = true;
                 }
             }
             if (start_node->role == PdmRoles::SubRbd) {
@@ -2484,46 +4419,431 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
                 if (ec) return std::nullopt;
                 if(sv.has_value()) {
                     if(sv->failure_rate.has_value()){
-                        model->chain.push_back(details::RBDPartModel(details::Node(sv->failure_rate.value())));
+                        auto ref = std::get<WiPdmSubRbdExtension>(*rbdExtension(start_node)).ref.value();
+                        model->chain.push_back(details::RBDPartModel(details::Node(sv->failure_rate.value(), start_node->semantic, std::move(ref))));
                         calculated = true;
                     }
                 }
             }
             else if (start_node->role == PdmRoles::RbdGroupStart) {
-                auto group = getRbdGroup(initiatingService,start_node->semantic, sessionPtr, ec, yield, mctx);
-                if (ec) return std::nullopt;
-
-                auto gr_model = getRbdReservedModel(initiatingService, group.value(),  sessionPtr, ec, yield, mctx);
+                auto gr_model = getRbdReservedModel(initiatingService, graph, curr, sessionPtr, ec, yield, mctx);
                 if (ec) return std::nullopt;
                 if(gr_model.has_value()) {
                     model->chain.push_back(details::RBDPartModel(std::move(gr_model.value())));
                     calculated = true;
                 }
 
-                start_node = fetchRawNodeEntity(initiatingService,group.value().target,sessionPtr, ec, yield, mctx);
-                if (ec) return std::nullopt;
+                curr = graph.pairs[curr];
             }
 
             // end loop condition (or at least one thats not a error
-            if(start_node->semantic == end_node->semantic) break;
-
-            std::optional<std::string> output;
-            getRbdElementOutput(initiatingService, start_node, output, sessionPtr, ec, yield, mctx);
-            if (ec) return std::nullopt;
+            if(curr == target) break;
 
-            if (!output.has_value()) {
+            switch(graph.nodes[curr]->role){
+                case PdmRoles::RbdInputNode:
+                case PdmRoles::RbdBlock:
+                case PdmRoles::SubRbd:
+                case PdmRoles::RbdGroupEnd:
+                    break;
+                default:
+                    ec = make_error_code(error::not_an_rbd_element);
+                    return std::nullopt;
+            }
+            if (graph.outDegree(curr) != 1) {
                 ec = make_error_code(error::invalid_rbd_element);
                 return std::nullopt;
             }
 
-            start_node = fetchRawNodeEntity(initiatingService,output.value(),sessionPtr, ec, yield, mctx);
-            if (ec) return std::nullopt;
-
-        } while(true);
+            curr = graph.output(curr);
+            if (curr == details::RbdGraph::none) {
+                ec = make_error_code(error::node_not_found);
+                return std::nullopt;
+            }
+        }
         if(!calculated) return std::nullopt; // not an error, just no value
         return std::make_optional(std::move(model));
     }
 
+    // накладывает новые интенсивности блоков на копию модели; nullptr - блок появился в модели или пропал из нее
+    PdmService::RbdProgramPtr patchRbdProgram(const PdmService::RbdProgramPtr &program, const std::map<std::string, std::optional<Number>> &leaves) {
+        std::unordered_map<std::string_view, std::uint32_t> slots;
+        slots.reserve(program->leaves->size());
+        for(std::uint32_t i = 0; i < program->leaves->size(); ++i) {
+            slots.emplace((*program->leaves)[i], i);
+        }
+        std::shared_ptr<details::RbdProgram> patched;
+        for(const auto &[leaf, rate]:leaves) {
+            auto slot = slots.find(leaf);
+            if(slot == slots.end() && !rate.has_value()) continue;
+            if(slot == slots.end() || !rate.has_value()) return nullptr;
+            const auto &current = patched ? *patched : *program;
+            if(current.rates[slot->second] == rate.value()) continue;
+            if(!patched) patched = std::make_shared<details::RbdProgram>(*program);
+            RbdModel::patch(*patched, slot->second, rate.value());
+        }
+        if(!patched) return program;
+        return patched;
+    }
+
+    PdmService::RbdProgramPtr PdmService::cachedRbdModel(const std::string &schema, RbdModelStamp &stamp, std::shared_ptr<MethodContextInterface> ctx) const {
+        auto pmc = std::dynamic_pointer_cast<PdmMethodContext>(ctx);
+        if(pmc && pmc->rbdChanges().contains(schema)) {
+            stamp.local = true;
+            auto &programs = pmc->rbdPrograms();
+            if(auto it = programs.find(schema); it != programs.end()) return it->second;
+            if(pmc->rbdChanges().topology.count(schema)) return nullptr;
+        }
+        RbdProgramPtr program;
+        {
+            std::lock_guard<std::mutex> lock(m_rbdModelsMutex);
+            const auto &version = m_rbdVersions[schema];
+            stamp.topology = version.topology;
+            stamp.rates = version.rates;
+            stamp.unsettled = std::chrono::steady_clock::now() < version.unsettled;
+            if(stamp.unsettled) return nullptr;
+            auto it = m_rbdModels.find(schema);
+            if(it != m_rbdModels.end() && it->second.topology == version.topology && it->second.rates == version.rates) {
+                program = it->second.program;
+            }
+        }
+        // интенсивности, измененные транзакцией, накладываются на подтвержденную модель
+        if(program && stamp.local) {
+            program = patchRbdProgram(program, pmc->rbdChanges().leaves.at(schema));
+            if(program) {
+                pmc->rbdPrograms()[schema] = program;
+            }
+            else {
+                pmc->rbdChanges().topology.insert(schema);
+            }
+        }
+        return program;
+    }
+
+    void PdmService::storeRbdModel(const std::string &schema, const RbdModelStamp &stamp, RbdProgramPtr program, std::shared_ptr<MethodContextInterface> ctx) const {
+        if(stamp.local) {
+            if(auto pmc = std::dynamic_pointer_cast<PdmMethodContext>(ctx)) {
+                pmc->rbdPrograms()[schema] = std::move(program);
+            }
+            return;
+        }
+        if(stamp.unsettled) return;
+        std::lock_guard<std::mutex> lock(m_rbdModelsMutex);
+        const auto &version = m_rbdVersions[schema];
+        // пока модель строилась, схему успели поменять
+        if(version.topology != stamp.topology || version.rates != stamp.rates
+           || std::chrono::steady_clock::now() < version.unsettled) return;
+        auto &entry = m_rbdModels[schema];
+        if(entry.topology != stamp.topology) {
+            entry.cutSets.clear();
+        }
+        entry.topology = stamp.topology;
+        entry.rates = stamp.rates;
+        entry.program = std::move(program);
+    }
+
+    void PdmService::patchRbdModelLeaf(const std::string &schema, const std::string &leaf, const std::optional<Number> &rate, std::shared_ptr<MethodContextInterface> ctx) const {
+        auto pmc = std::dynamic_pointer_cast<PdmMethodContext>(ctx);
+        if(!pmc) {
+            details::RbdModelChanges changes;
+            changes.leaves[schema][leaf] = rate;
+            unsettleRbdModels(changes);
+            return;
+        }
+        auto &changes = pmc->rbdChanges();
+        // структура и так будет построена заново
+        if(changes.topology.count(schema)) return;
+        changes.leaves[schema][leaf] = rate;
+        auto &programs = pmc->rbdPrograms();
+        auto it = programs.find(schema);
+        if(it == programs.end()) return;
+        if(auto patched = patchRbdProgram(it->second, {{leaf, rate}}); patched) {
+            it->second = std::move(patched);
+        }
+        else {
+            programs.erase(it);
+            changes.topology.insert(schema);
+        }
+    }
+
+    void PdmService::invalidateRbdModel(const std::string &schema, std::shared_ptr<MethodContextInterface> ctx) const {
+        auto pmc = std::dynamic_pointer_cast<PdmMethodContext>(ctx);
+        if(!pmc) {
+            details::RbdModelChanges changes;
+            changes.topology.insert(schema);
+            unsettleRbdModels(changes);
+            return;
+        }
+        pmc->rbdChanges().topology.insert(schema);
+        pmc->rbdChanges().leaves.erase(schema);
+        pmc->rbdPrograms().erase(schema);
+    }
+
+    void PdmService::publishRbdModels(const details::RbdModelChanges &changes) const {
+        std::lock_guard<std::mutex> lock(m_rbdModelsMutex);
+        for(const auto &schema:changes.topology) {
+            ++m_rbdVersions[schema].topology;
+            m_rbdModels.erase(schema);
+        }
+        for(const auto &[schema, leaves]:changes.leaves) {
+            auto &version = m_rbdVersions[schema];
+            auto it = m_rbdModels.find(schema);
+            // модели, построенные до коммита, сохранить уже не смогут
+            const bool valid = it != m_rbdModels.end() && it->second.topology == version.topology && it->second.rates == version.rates;
+            ++version.rates;
+            if(!valid) continue;
+            if(auto patched = patchRbdProgram(it->second.program, leaves); patched) {
+                it->second.program = std::move(patched);
+                it->second.rates = version.rates;
+            }
+            else {
+                m_rbdModels.erase(it);
+            }
+        }
+    }
+
+    void PdmService::unsettleRbdModels(const details::RbdModelChanges &changes) const {
+        const auto until = std::chrono::steady_clock::now()
+                         + std::chrono::milliseconds(WI_CONFIGURATION().read_settings<size_t>(server_method_timeout));
+        std::lock_guard<std::mutex> lock(m_rbdModelsMutex);
+        auto unsettle = [&](const std::string &schema) {
+            auto &version = m_rbdVersions[schema];
+            ++version.topology;
+            version.unsettled = std::max(version.unsettled, until);
+            m_rbdModels.erase(schema);
+        };
+        for(const auto &schema:changes.topology) {
+            unsettle(schema);
+        }
+        for(const auto &[schema, leaves]:changes.leaves) {
+            unsettle(schema);
+        }
+    }
+
+    PdmService::RbdCutSetsPtr PdmService::cachedRbdCutSets(const std::string &schema, std::uint64_t topology, bool paths, std::uint32_t order) const {
+        std::lock_guard<std::mutex> lock(m_rbdModelsMutex);
+        auto it = m_rbdModels.find(schema);
+        if(it == m_rbdModels.end() || it->second.topology != topology) return nullptr;
+        auto sets = it->second.cutSets.find({paths, order});
+        return sets == it->second.cutSets.end() ? nullptr : sets->second;
+    }
+
+    void PdmService::storeRbdCutSets(const std::string &schema, std::uint64_t topology, bool paths, std::uint32_t order, RbdCutSetsPtr sets) const {
+        std::lock_guard<std::mutex> lock(m_rbdModelsMutex);
+        auto it = m_rbdModels.find(schema);
+        // без модели в кэше сечениям не с чем жить
+        if(it == m_rbdModels.end() || it->second.topology != topology) return;
+        it->second.cutSets[{paths, order}] = std::move(sets);
+    }
+
+    bool PdmService::cachedChildRates(const std::string &parent, std::optional<Number> &sum, std::shared_ptr<MethodContextInterface> ctx) const {
+        auto pmc = std::dynamic_pointer_cast<PdmMethodContext>(ctx);
+        if(!pmc) return false;
+        auto &sums = pmc->childRates();
+        auto it = sums.find(parent);
+        if(it == sums.end()) return false;
+        sum = it->second.children.empty() ? std::nullopt : std::make_optional(it->second.sum);
+        return true;
+    }
+
+    void PdmService::storeChildRates(const std::string &parent, std::unordered_map<std::string, Number> &&rates, std::shared_ptr<MethodContextInterface> ctx) const {
+        // без контекста транзакции прочитанное не с чем связать
+        auto pmc = std::dynamic_pointer_cast<PdmMethodContext>(ctx);
+        if(!pmc) return;
+        auto &entry = pmc->childRates()[parent];
+        entry.children = std::move(rates);
+        entry.sum = 0_Nr;
+        for(const auto &[child, rate]:entry.children) {
+            entry.sum += rate;
+        }
+    }
+
+    void PdmService::applyChildRate(const std::string &child, std::int32_t role, const std::optional<Number> &rate, std::shared_ptr<MethodContextInterface> ctx) const {
+        if(!isRateContributor(role)) return;
+        auto pmc = std::dynamic_pointer_cast<PdmMethodContext>(ctx);
+        if(!pmc) return;
+        boost::system::error_code tec;
+        auto parent = parentSemantic(child, tec);
+        if(tec) return;
+        auto &sums = pmc->childRates();
+        auto it = sums.find(parent);
+        if(it == sums.end()) return;
+        auto &entry = it->second;
+        auto c = entry.children.find(child);
+        if(rate.has_value()) {
+            if(c == entry.children.end()) {
+                entry.children.emplace(child, rate.value());
+                entry.sum += rate.value();
+            }
+            else {
+                entry.sum += rate.value() - c->second;
+                c->second = rate.value();
+            }
+        }
+        else if(c != entry.children.end()) {
+            entry.sum -= c->second;
+            entry.children.erase(c);
+        }
+        // без детей начинаем сумму заново, чтобы не копить погрешность
+        if(entry.children.empty()) entry.sum = 0_Nr;
+    }
+
+    void PdmService::invalidateChildRates(const std::string &semantic, bool subtree, std::shared_ptr<MethodContextInterface> ctx) const {
+        auto pmc = std::dynamic_pointer_cast<PdmMethodContext>(ctx);
+        if(!pmc) return;
+        auto &sums = pmc->childRates();
+        sums.erase(semantic);
+        if(subtree) {
+            const auto prefix = semantic + "::";
+            for(auto it = sums.lower_bound(prefix); it != sums.end() && it->first.compare(0, prefix.size(), prefix) == 0;) {
+                it = sums.erase(it);
+            }
+        }
+    }
+
+    std::shared_ptr<const details::RbdExtension> PdmService::rbdExtension(const std::shared_ptr<WiPdmRawNodeEntity> &node) const {
+        switch(node->role){
+            case PdmRoles::RbdInputNode:
+            case PdmRoles::RbdOutputNode:
+            case PdmRoles::RbdBlock:
+            case PdmRoles::SubRbd:
+            case PdmRoles::RbdGroupStart:
+            case PdmRoles::RbdGroupEnd:
+                break;
+            default:
+                return std::make_shared<details::RbdExtension>();
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_rbdExtensionsMutex);
+            auto it = m_rbdExtensions.find(node->semantic);
+            if(it != m_rbdExtensions.end()) {
+                auto &entry = it->second;
+                if(entry.node.lock() == node) return entry.decoded;
+                // тот же узел, полученный другим запросом (например, загрузкой всей схемы)
+                if(entry.role == node->role && entry.extension == node->extension) {
+                    entry.node = node;
+                    return entry.decoded;
+                }
+            }
+        }
+
+        auto decoded = std::make_shared<details::RbdExtension>();
+        if(node->extension.has_value()) {
+            const auto &json = node->extension.value();
+            switch(node->role){
+                case PdmRoles::RbdInputNode:
+                    *decoded = fromJson<WiPdmRbdInputNodeExtension>(json);
+                    break;
+                case PdmRoles::RbdOutputNode:
+                    *decoded = fromJson<WiPdmRbdOutputNodeExtension>(json);
+                    break;
+                case PdmRoles::RbdBlock:
+                    *decoded = fromJson<WiPdmRbdBlockExtension>(json);
+                    break;
+                case PdmRoles::SubRbd:
+                    *decoded = fromJson<WiPdmSubRbdExtension>(json);
+                    break;
+                case PdmRoles::RbdGroupStart:
+                    *decoded = fromJson<WiPdmRbdGroupStartExtension>(json);
+                    break;
+                case PdmRoles::RbdGroupEnd:
+                    *decoded = fromJson<WiPdmRbdGroupEndExtension>(json);
+                    break;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(m_rbdExtensionsMutex);
+        // при переполнении кэш начинается заново, схемы в работе разберутся повторно
+        if(m_rbdExtensions.size() >= rbd_extensions_max && !m_rbdExtensions.count(node->semantic)) {
+            m_rbdExtensions.clear();
+        }
+        auto &entry = m_rbdExtensions[node->semantic];
+        entry.node = node;
+        entry.role = node->role;
+        entry.extension = node->extension;
+        entry.decoded = decoded;
+        return decoded;
+    }
+
+    void PdmService::invalidateRbdExtension(const std::string &semantic, bool subtree) const {
+        std::lock_guard<std::mutex> lock(m_rbdExtensionsMutex);
+        if(!subtree) {
+            m_rbdExtensions.erase(semantic);
+            return;
+        }
+        const auto prefix = semantic + "::";
+        auto last = m_rbdExtensions.lower_bound(prefix);
+        while(last != m_rbdExtensions.end() && last->first.compare(0, prefix.size(), prefix) == 0) {
+            ++last;
+        }
+        m_rbdExtensions.erase(m_rbdExtensions.lower_bound(semantic), last);
+    }
+
+    void PdmService::orderRbdSchemas(
+            std::size_t initiatingService,
+            const std::set<std::string> &schemas,
+            std::vector<std::vector<std::string>> &levels,
+            const std::shared_ptr<IWiSession> sessionPtr,
+            boost::system::error_code &ec,
+            const net::yield_context &yield,
+            std::shared_ptr<MethodContextInterface> ctx) const noexcept(true){
+        GUARD_PDM_METHOD();
+        // схема -> схемы, подсхемы которых на нее ссылаются
+        std::map<std::string, std::set<std::string>> dependents;
+        // схема -> количество еще не упорядоченных схем, от которых она зависит
+        std::map<std::string, std::size_t> dependencies;
+
+        std::vector<std::string> queue(schemas.begin(), schemas.end());
+        while(!queue.empty()) {
+            auto schema = std::move(queue.back());
+            queue.pop_back();
+            if(dependents.count(schema)) continue;
+            auto &edges = dependents[schema];
+            dependencies[schema];
+
+            boost::system::error_code tec;
+            auto node = fetchRawNode(initiatingService, schema, sessionPtr, tec, yield, mctx);
+            if(tec || !node) continue;
+            if(node->role != PdmRoles::RbdSchema || !node->extension.has_value()) continue;
+
+            WiPdmRbdExtension extension = fromJson<decltype(extension)>(node->extension.value());
+            for(const auto &sub:extension.sub_rbd_ref) {
+                auto parent = parentSemantic(sub, tec);
+                if(tec) {
+                    tec = boost::system::error_code();
+                    continue;
+                }
+                if(edges.insert(parent).second) {
+                    ++dependencies[parent];
+                    queue.push_back(parent);
+                }
+            }
+        }
+
+        std::vector<std::string> level;
+        for(const auto &[schema, count]:dependencies) {
+            if(count == 0) level.push_back(schema);
+        }
+        std::size_t ordered = 0;
+        while(!level.empty()) {
+            std::vector<std::string> next;
+            for(const auto &schema:level) {
+                for(const auto &parent:dependents[schema]) {
+                    if(--dependencies[parent] == 0) next.push_back(parent);
+                }
+            }
+            ordered += level.size();
+            levels.push_back(std::move(level));
+            level = std::move(next);
+        }
+
+        if(ordered != dependencies.size()) {
+            for(const auto &[schema, count]:dependencies) {
+                if(count != 0) WI_LOG_ERROR() << "RBD SCHEMA DEPENDENCY CYCLE " << schema;
+            }
+            ec = make_error_code(error::sub_rbd_cant_be_binded_with_own_parent);
+        }
+    }
+
     void PdmService::provisionRbdFlags(
             std::size_t initiatingService,
             const std::string &schema,
@@ -2545,20 +4865,22 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
 
         WiPdmRawNodeEntity::Container nodes;
         fetchRawNodesEntity(initiatingService,schema,nodes,sessionPtr,ec,yield,mctx);
+        if(ec) return;
         std::set<std::string> elements;
         while(!nodes.empty()){
             if(flags.contains_duplicates && flags.empty_blocks && flags.blocks_w_elements_wo_parameters) {
                 nodes.clear();
                 continue;
             }
-            auto node = nodes.back();
+            auto node = std::make_shared<WiPdmRawNodeEntity>(std::move(nodes.back()));
             nodes.pop_back();
-            if(node.role == PdmRoles::RbdBlock){
-                if(!node.extension.has_value()){
+            if(node->role == PdmRoles::RbdBlock){
+                if(!node->extension.has_value()){
                     flags.empty_blocks = true;
                     continue;
                 }
-                WiPdmRbdBlockExtension blockExt = fromJson<WiPdmRbdBlockExtension>(node.extension.value());
+                const auto decoded = rbdExtension(node);
+                const auto &blockExt = std::get<WiPdmRbdBlockExtension>(*decoded);
                 if(!blockExt.ref.has_value()){
                     flags.empty_blocks = true;
                     continue;
@@ -2572,9 +4894,7 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
                 }
                 std::optional<long double> placeholder;
 
-                auto _node = fetchRawNodeEntity(initiatingService,node.semantic,sessionPtr,ec,yield,mctx);
-                if(ec) return;
-                auto vars = getRbdBlockElementVars(initiatingService,_node,placeholder,sessionPtr,ec,yield,mctx);
+                auto vars = getRbdBlockElementVars(initiatingService,node,placeholder,sessionPtr,ec,yield,mctx);
                 if(ec) return;
                 if(!vars.has_value()) {
                     flags.blocks_w_elements_wo_parameters = true;
@@ -2586,13 +4906,14 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
                     continue;
                 }
             }
-            if(node.role == PdmRoles::SubRbd)
+            if(node->role == PdmRoles::SubRbd)
             {
-                if(!node.extension.has_value()){
+                if(!node->extension.has_value()){
                     flags.empty_blocks = true;
                     continue;
                 }
-                WiPdmSubRbdExtension subExt = fromJson<WiPdmSubRbdExtension>(node.extension.value());
+                const auto decoded = rbdExtension(node);
+                const auto &subExt = std::get<WiPdmSubRbdExtension>(*decoded);
                 if(!subExt.ref.has_value()){
                     flags.empty_blocks = true;
                     continue;
@@ -2606,9 +4927,7 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
                 }
                 std::optional<long double> placeholder;
 
-                auto _node = fetchRawNodeEntity(initiatingService,node.semantic,sessionPtr,ec,yield,mctx);
-                if(ec) return;
-                auto vars = getSubRbdRefSchemaVars(initiatingService,_node,placeholder,sessionPtr,ec,yield,mctx);
+                auto vars = getSubRbdRefSchemaVars(initiatingService,node,placeholder,sessionPtr,ec,yield,mctx);
                 if(ec) return;
                 if(!vars.has_value()) {
                     flags.subs_w_not_calculated_schemas = true;
@@ -2626,7 +4945,10 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         if(schemaNode->extension.has_value()){
             ext = fromJson<WiPdmRbdExtension>(schemaNode->extension.value());
         }
+        // флаги не изменились - записывать нечего
+        auto before = toJson(ext);
         ext.flags = flags;
+        if(toJson(ext) == before) return;
         updateSchemaQuery.extension = toJson(ext);
         updateSchemaQuery.updateExtension = true;
 
@@ -3007,7 +5329,20 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         addNewNodeInternal(initiatingService, templates, sessionPtr, Filter::filterOff, ec, yield, mctx);
     }
 
-    std::optional<WiRbdChain> PdmService::copyRbdChainInternal(
+    std::optional<WiRbdChain> PdmService::copyRbdChainInternal(
+            std::size_t initiatingService,
+            const std::string& target_schema_semantic,
+            const WiRbdChain &query,
+            const std::shared_ptr<IWiSession> sessionPtr,
+            boost::system::error_code &ec,
+            const net::yield_context &yield,
+            std::shared_ptr<MethodContextInterface> ctx) const noexcept(true)
+    {
+        GUARD_PDM_METHOD();
+        return copyRbdSubgraphInternal(initiatingService, target_schema_semantic, query, sessionPtr, ec, yield, mctx);
+    }
+
+    std::optional<WiRbdChain> PdmService::copyRbdSubgraphInternal(
             std::size_t initiatingService,
             const std::string& target_schema_semantic,
             const WiRbdChain &query,
@@ -3018,81 +5353,142 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
     {
         GUARD_PDM_METHOD();
 
-        auto start_node = fetchRawNodeEntity(initiatingService,query.source,sessionPtr, ec, yield, mctx);
-        if (ec || !start_node) return std::nullopt;
-
-        auto end_node = fetchRawNodeEntity(initiatingService,query.target,sessionPtr, ec, yield, mctx);
-        if (ec || !end_node) return std::nullopt;
-
-        std::list<WiRbdChain> copies;
-
-        do
-        {
-            if (start_node->role == PdmRoles::RbdBlock || start_node->role == PdmRoles::SubRbd)
-            {
-                auto copy_semantic = copyRbdBlockElement(initiatingService, target_schema_semantic,
-                                                         start_node->semantic, sessionPtr, ec, yield, mctx);
-                if (ec || !copy_semantic.has_value()) return std::nullopt;
-
-                moveRbdRefs(initiatingService, start_node->semantic, copy_semantic->semantic,
-                            sessionPtr, ec, yield, mctx);
-                if (ec) return std::nullopt;
-
-                WiRbdLink link;
-                link.source = copy_semantic->semantic;
-                link.target = copy_semantic->semantic;
-
-                copies.push_back(link);
-            }
-            else if (start_node->role == PdmRoles::RbdGroupStart)
-            {
-                auto group = getRbdGroup(initiatingService,start_node->semantic,sessionPtr, ec, yield, mctx);
-                if (ec || !group.has_value()) return std::nullopt;
+        checkNode(initiatingService,target_schema_semantic,PdmRoles::RbdSchema,sessionPtr,ec,yield,mctx);
+        if (ec) return std::nullopt;
 
-                auto group_copy = copyRbdGroupInternal(initiatingService, target_schema_semantic,
-                                                       group.value(), sessionPtr, ec, yield, mctx);
-                if (ec || !group_copy.has_value()) return std::nullopt;
+        auto schema = parentSemantic(query.source, ec);
+        if (ec) return std::nullopt;
+        auto graph = getRbdGraph(initiatingService, schema, sessionPtr, ec, yield, mctx);
+        if (ec || !graph) return std::nullopt;
 
-                copies.push_back(group_copy.value());
+        const auto source = graph->find(query.source);
+        const auto target = graph->find(query.target);
+        if (source == details::RbdGraph::none || target == details::RbdGraph::none) {
+            ec = make_error_code(error::node_not_found);
+            return std::nullopt;
+        }
 
-                start_node = fetchRawNodeEntity(initiatingService,group.value().target,sessionPtr, ec, yield, mctx);
-                if (ec) return std::nullopt;
+        // все узлы участка, в порядке обхода от source; за target не выходим
+        std::vector<std::uint32_t> order;
+        std::unordered_map<std::string, std::string> copies;
+        std::vector<std::uint32_t> stack{source};
+        while (!stack.empty()) {
+            const auto i = stack.back();
+            stack.pop_back();
+            const auto &node = graph->nodes[i];
+            if (copies.count(node->semantic)) continue;
+            switch (node->role) {
+                case PdmRoles::RbdBlock:
+                case PdmRoles::SubRbd:
+                case PdmRoles::RbdGroupStart:
+                case PdmRoles::RbdGroupEnd:
+                    break;
+                default:
+                    ec = make_error_code(error::invalid_rbd_element);
+                    return std::nullopt;
             }
-
-            // end loop condition
-            if(start_node->semantic == end_node->semantic)
-                break;
-
-            std::optional<std::string> output;
-            getRbdElementOutput(initiatingService, start_node, output, sessionPtr, ec, yield, mctx);
-            if (ec) return std::nullopt;
-
-            if (!output.has_value()) {
+            copies.emplace(node->semantic, newNodeSemantic(target_schema_semantic));
+            order.push_back(i);
+            if (i == target) continue;
+            if (graph->outDegree(i) == 0) {
                 ec = make_error_code(error::invalid_rbd_element);
                 return std::nullopt;
             }
+            for (std::uint32_t j = graph->outDegree(i); j-- > 0;) {
+                const auto next = graph->output(i, j);
+                if (next == details::RbdGraph::none) {
+                    ec = make_error_code(error::node_not_found);
+                    return std::nullopt;
+                }
+                stack.push_back(next);
+            }
+        }
 
-            start_node = fetchRawNodeEntity(initiatingService,output.value(),sessionPtr, ec, yield, mctx);
-            if (ec) return std::nullopt;
-
-        } while(true);
+        // связи на узлы вне участка не копируются
+        auto remap = [&copies](const std::optional<std::string> &link) -> std::optional<std::string> {
+            if (!link.has_value()) return std::nullopt;
+            auto it = copies.find(link.value());
+            if (it == copies.end()) return std::nullopt;
+            return it->second;
+        };
+        auto remapAll = [&copies](const std::vector<std::string> &links) {
+            std::vector<std::string> result;
+            result.reserve(links.size());
+            for (const auto &link:links) {
+                if (auto it = copies.find(link); it != copies.end()) result.push_back(it->second);
+            }
+            return result;
+        };
 
-        WiRbdChain chain = copies.front();
-        for(auto it = ++ copies.begin(); it != copies.end(); ++it)
-        {
-            WiRbdLink link;
-            link.source = chain.target;
-            link.target = it->source;
-            addRbdLink(initiatingService,link,sessionPtr,ec,yield,mctx);
-            if(ec) return std::nullopt;
+        // узлы создаются сразу с итоговыми связями, без последующих обновлений
+        for (const auto i : order) {
+            const auto &node = graph->nodes[i];
+            const auto decoded = rbdExtension(node);
+            WiNewPdmNodeQuery newNodeQuery;
+            newNodeQuery.parent = target_schema_semantic;
+            newNodeQuery.role = node->role;
+            newNodeQuery.header = node->header;
+            newNodeQuery.description = node->description;
+            switch (node->role) {
+                case PdmRoles::RbdBlock: {
+                    // привязка к компоненту переносится ниже через moveRbdRefs
+                    WiPdmRbdBlockExtension extension;
+                    if (const auto *orig = std::get_if<WiPdmRbdBlockExtension>(decoded.get())) {
+                        extension.input = remap(orig->input);
+                        extension.output = remap(orig->output);
+                    }
+                    newNodeQuery.extension = toJson(extension);
+                }
+                    break;
+                case PdmRoles::SubRbd: {
+                    WiPdmSubRbdExtension extension;
+                    if (const auto *orig = std::get_if<WiPdmSubRbdExtension>(decoded.get())) {
+                        extension.input = remap(orig->input);
+                        extension.output = remap(orig->output);
+                    }
+                    newNodeQuery.extension = toJson(extension);
+                }
+                    break;
+                case PdmRoles::RbdGroupStart: {
+                    WiPdmRbdGroupStartExtension extension;
+                    if (const auto *orig = std::get_if<WiPdmRbdGroupStartExtension>(decoded.get())) {
+                        extension.input = remap(orig->input);
+                        extension.outputs = remapAll(orig->outputs);
+                        extension.end = remap(orig->end);
+                    }
+                    newNodeQuery.extension = toJson(extension);
+                    // порог k-из-n хранится рядом с полями расширения группы
+                    if (node->extension.has_value() && node->extension->contains("k")) {
+                        newNodeQuery.extension.value()["k"] = node->extension->at("k");
+                    }
+                }
+                    break;
+                case PdmRoles::RbdGroupEnd: {
+                    WiPdmRbdGroupEndExtension extension;
+                    if (const auto *orig = std::get_if<WiPdmRbdGroupEndExtension>(decoded.get())) {
+                        extension.inputs = remapAll(orig->inputs);
+                        extension.output = remap(orig->output);
+                        extension.start = remap(orig->start);
+                    }
+                    newNodeQuery.extension = toJson(extension);
+                }
+                    break;
+            }
+            addNewNodeInternal(initiatingService, newNodeQuery, copies[node->semantic], sessionPtr, Filter::filterOn, ec, yield, mctx);
+            if (ec) return std::nullopt;
+        }
 
-            chain = *it;
+        for (const auto i : order) {
+            const auto role = graph->nodes[i]->role;
+            if (role != PdmRoles::RbdBlock && role != PdmRoles::SubRbd) continue;
+            const auto &semantic = graph->nodes[i]->semantic;
+            moveRbdRefs(initiatingService, semantic, copies[semantic], sessionPtr, ec, yield, mctx);
+            if (ec) return std::nullopt;
         }
 
         WiRbdChain result;
-        result.source = copies.front().source;
-        result.target = copies.back().target;
-
+        result.source = copies[query.source];
+        result.target = copies[query.target];
         return result;
     }
 
@@ -3123,35 +5519,7 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             return std::nullopt;
         }
 
-        checkNode(initiatingService,target_schema_semantic,PdmRoles::RbdSchema,sessionPtr,ec,yield,mctx);
-        if (ec) return std::nullopt;
-
-        WiRbdChain result;
-        {
-            auto group_res = createRbdGroup(initiatingService, target_schema_semantic, sessionPtr, ec, yield, mctx);
-            if (!group_res || ec) return std::nullopt;
-            result = group_res.value();
-        }
-
-        std::vector<std::string> orig_outputs;
-        getRbdElementOutputs(initiatingService,orig_start_node,orig_outputs,sessionPtr,ec,yield,mctx);
-        if(ec) return std::nullopt;
-
-        for(const auto& orig_output: orig_outputs)
-        {
-            WiRbdChain orig_chain;
-            orig_chain.source = orig_output;
-            orig_chain.target = orig_group.target;
-
-            auto result_chain = copyRbdChainInternal(initiatingService, target_schema_semantic, orig_chain,
-                                                     sessionPtr,ec,yield,mctx);
-            if (ec) return std::nullopt;
-
-            insertRbdChainIntoGroup(initiatingService, result, result_chain.value(), sessionPtr,ec,yield,mctx);
-            if (ec) return std::nullopt;
-        }
-
-        return result;
+        return copyRbdSubgraphInternal(initiatingService, target_schema_semantic, orig_group, sessionPtr, ec, yield, mctx);
     }
 
     std::optional<WiSemanticResult> PdmService::copyRbdBlockElement(
@@ -4210,20 +6578,37 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             return;
         }
 
+        // привязки снимаются до расчета связей, сами связи они не меняют
+        std::map<std::string, std::set<std::string>> bySchema;
         for(const auto &block:elementsForDelete){
-            auto schema = nodeNearestAncestor(initiatingService,block,PdmRoles::RbdSchema,1,sessionPtr,ec,yield,mctx);
-            if(ec) return;
-            schemas.insert(schema.semantic);
-            deleteRbdBlock(initiatingService,WiSemanticOnlyQuery{block},sessionPtr,ec, yield, mctx);
-
-            //если это не блок, то может это свёртка
-            if(ec.value() == error::invalid_node_role)
-            {
-                ec = make_error_code(ok);
-                deleteSubRbd(initiatingService,WiSemanticOnlyQuery{block},sessionPtr,ec, yield, mctx);
+            auto node = fetchRawNodeEntity(initiatingService,block,sessionPtr,ec,yield,mctx);
+            if(ec || !node) return;
+            const auto decoded = rbdExtension(node);
+            if(node->role == PdmRoles::RbdBlock){
+                const auto *extension = std::get_if<WiPdmRbdBlockExtension>(decoded.get());
+                if(extension && extension->ref.has_value()){
+                    unbindPdmComponentWithRbdBlockInternal(initiatingService,extension->ref.value(),block,sessionPtr,ec,yield,mctx);
+                    if(ec) return;
+                }
+            }else if(node->role == PdmRoles::SubRbd){
+                const auto *extension = std::get_if<WiPdmSubRbdExtension>(decoded.get());
+                if(extension && extension->ref.has_value()){
+                    unbindRbdSchemaWithSubRbdInternal(initiatingService,extension->ref.value(),block,sessionPtr,ec,yield,mctx);
+                    if(ec) return;
+                }
+            }else{
+                ec = make_error_code(error::invalid_node_role);
+                return;
             }
+            auto schema = parentSemantic(block,ec);
+            if(ec) return;
+            bySchema[schema].insert(block);
+        }
 
+        for(const auto &[schema, elements]:bySchema){
+            deleteRbdElementsInternal(initiatingService,schema,elements,sessionPtr,ec,yield,mctx);
             if(ec) return;
+            schemas.insert(schema);
         }
 
         //provision schemas
@@ -4233,6 +6618,190 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         }
     }
 
+    void PdmService::deleteRbdElementsInternal(
+            std::size_t initiatingService,
+            const std::string &schema,
+            const std::set<std::string> &elements,
+            const std::shared_ptr<IWiSession> sessionPtr,
+            boost::system::error_code &ec,
+            const net::yield_context &yield,
+            std::shared_ptr<MethodContextInterface> ctx) const noexcept(true){
+        GUARD_PDM_METHOD();
+        auto graph = getRbdGraph(initiatingService,schema,sessionPtr,ec,yield,mctx);
+        if(ec || !graph) return;
+
+        // связи элементов схемы, которые меняются в памяти так же, как это сделал бы detachRbdChain
+        struct Links{
+            std::vector<std::string> inputs;
+            std::vector<std::string> outputs;
+        };
+        std::unordered_map<std::string, Links> links;
+        std::unordered_map<std::string, std::shared_ptr<WiPdmRawNodeEntity>> nodes;
+        for(const auto &node:graph->nodes){
+            nodes.emplace(node->semantic, node);
+            auto &l = links[node->semantic];
+            auto single = [](std::vector<std::string> &v, const std::optional<std::string> &link) {
+                if(link.has_value()) v.push_back(link.value());
+            };
+            const auto decoded = rbdExtension(node);
+            std::visit([&](const auto &extension) {
+                using T = std::decay_t<decltype(extension)>;
+                if constexpr (std::is_same_v<T, WiPdmRbdInputNodeExtension>) {
+                    single(l.outputs, extension.output);
+                } else if constexpr (std::is_same_v<T, WiPdmRbdOutputNodeExtension>) {
+                    single(l.inputs, extension.input);
+                } else if constexpr (std::is_same_v<T, WiPdmRbdBlockExtension> || std::is_same_v<T, WiPdmSubRbdExtension>) {
+                    single(l.inputs, extension.input);
+                    single(l.outputs, extension.output);
+                } else if constexpr (std::is_same_v<T, WiPdmRbdGroupStartExtension>) {
+                    single(l.inputs, extension.input);
+                    l.outputs = extension.outputs;
+                } else if constexpr (std::is_same_v<T, WiPdmRbdGroupEndExtension>) {
+                    l.inputs = extension.inputs;
+                    single(l.outputs, extension.output);
+                }
+            }, *decoded);
+        }
+        auto role = [&nodes](const std::string &semantic) {
+            auto it = nodes.find(semantic);
+            return it == nodes.end() ? 0 : it->second->role;
+        };
+
+        std::set<std::string> dirty;
+        std::set<std::string> removed;
+        auto unlink = [&](const std::string &source, const std::string &target) {
+            auto &outputs = links[source].outputs;
+            auto &inputs = links[target].inputs;
+            auto out = std::find(outputs.begin(), outputs.end(), target);
+            auto in = std::find(inputs.begin(), inputs.end(), source);
+            if(out == outputs.end() || in == inputs.end()) {
+                ec = make_error_code(error::rbd_elements_are_not_connected);
+                return;
+            }
+            outputs.erase(out);
+            inputs.erase(in);
+            dirty.insert(source);
+            dirty.insert(target);
+        };
+        auto link = [&](const std::string &source, const std::string &target) {
+            links[source].outputs.push_back(target);
+            links[target].inputs.push_back(source);
+            dirty.insert(source);
+            dirty.insert(target);
+        };
+        std::function<void(const std::string&)> detach = [&](const std::string &element) {
+            const auto &l = links[element];
+            if(l.inputs.size() >= 2) {
+                ec = make_error_code(error::rbd_element_has_multiple_inputs);
+                return;
+            }
+            if(l.outputs.size() >= 2) {
+                ec = make_error_code(error::rbd_element_has_multiple_outputs);
+                return;
+            }
+            if(l.inputs.empty()) return;
+            const auto left = l.inputs.front();
+            const auto right = l.outputs.empty() ? std::optional<std::string>() : std::make_optional(l.outputs.front());
+            unlink(left, element);
+            if(ec || !right.has_value()) return;
+            unlink(element, right.value());
+            if(ec) return;
+
+            if(role(left) != PdmRoles::RbdGroupStart || role(right.value()) != PdmRoles::RbdGroupEnd) {
+                link(left, right.value());
+                return;
+            }
+            // из группы ушла ветка: группа из одной ветки разворачивается в цепочку
+            if(links[left].outputs.size() < 2) {
+                detach(left);
+                if(ec) return;
+                removed.insert(left);
+            }
+            if(links[right.value()].inputs.size() < 2) {
+                detach(right.value());
+                if(ec) return;
+                removed.insert(right.value());
+            }
+        };
+
+        for(const auto &element:elements){
+            if(!nodes.count(element)) {
+                ec = make_error_code(error::node_not_found);
+                return;
+            }
+            detach(element);
+            if(ec) return;
+            removed.insert(element);
+        }
+
+        std::vector<WiUpdatePdmNodeQuery> updates;
+        for(const auto &semantic:dirty){
+            if(removed.count(semantic)) continue;
+            auto it = nodes.find(semantic);
+            if(it == nodes.end()) continue;
+            const auto &node = it->second;
+            const auto &l = links[semantic];
+            auto single = [](const std::vector<std::string> &v) {
+                return v.empty() ? std::optional<std::string>() : std::make_optional(v.front());
+            };
+            WiUpdatePdmNodeQuery update(*node);
+            const auto decoded = rbdExtension(node);
+            switch(node->role){
+                case PdmRoles::RbdInputNode: {
+                    auto extension = std::get<WiPdmRbdInputNodeExtension>(*decoded);
+                    extension.output = single(l.outputs);
+                    update.extension = toJson(extension);
+                }
+                    break;
+                case PdmRoles::RbdOutputNode: {
+                    auto extension = std::get<WiPdmRbdOutputNodeExtension>(*decoded);
+                    extension.input = single(l.inputs);
+                    update.extension = toJson(extension);
+                }
+                    break;
+                case PdmRoles::RbdBlock: {
+                    auto extension = std::get<WiPdmRbdBlockExtension>(*decoded);
+                    extension.input = single(l.inputs);
+                    extension.output = single(l.outputs);
+                    update.extension = toJson(extension);
+                }
+                    break;
+                case PdmRoles::SubRbd: {
+                    auto extension = std::get<WiPdmSubRbdExtension>(*decoded);
+                    extension.input = single(l.inputs);
+                    extension.output = single(l.outputs);
+                    update.extension = toJson(extension);
+                }
+                    break;
+                case PdmRoles::RbdGroupStart: {
+                    auto extension = std::get<WiPdmRbdGroupStartExtension>(*decoded);
+                    extension.input = single(l.inputs);
+                    extension.outputs = l.outputs;
+                    update.extension = toJson(extension);
+                }
+                    break;
+                case PdmRoles::RbdGroupEnd: {
+                    auto extension = std::get<WiPdmRbdGroupEndExtension>(*decoded);
+                    extension.inputs = l.inputs;
+                    extension.output = single(l.outputs);
+                    update.extension = toJson(extension);
+                }
+                    break;
+                default:
+                    continue;
+            }
+            update.updateExtension = true;
+            updates.push_back(std::move(update));
+        }
+        updateNodes(initiatingService,updates,sessionPtr,Filter::filterOn,ec,yield,mctx);
+        if(ec) return;
+
+        for(const auto &semantic:removed){
+            deleteNode(initiatingService,semantic,sessionPtr,Filter::filterOn,ec,yield,mctx);
+            if(ec) return;
+        }
+    }
+
     void PdmService::deleteRbdBlock(
             std::size_t initiatingService,
             const WiSemanticOnlyQuery &query,
@@ -4512,26 +7081,19 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             return;
         }
 
+        auto decoded = rbdExtension(element);
         switch(element->role){
-            case PdmRoles::RbdOutputNode: {
-                WiPdmRbdOutputNodeExtension extension = fromJson<decltype(extension)>(element->extension.value());
-                input = extension.input;
-            }
+            case PdmRoles::RbdOutputNode:
+                input = std::get<WiPdmRbdOutputNodeExtension>(*decoded).input;
                 break;
-            case PdmRoles::RbdBlock: {
-                WiPdmRbdBlockExtension extension = fromJson<decltype(extension)>(element->extension.value());
-                input = extension.input;
-            }
+            case PdmRoles::RbdBlock:
+                input = std::get<WiPdmRbdBlockExtension>(*decoded).input;
                 break;
-            case PdmRoles::SubRbd: {
-                WiPdmSubRbdExtension extension = fromJson<decltype(extension)>(element->extension.value());
-                input = extension.input;
-            }
+            case PdmRoles::SubRbd:
+                input = std::get<WiPdmSubRbdExtension>(*decoded).input;
                 break;
-            case PdmRoles::RbdGroupStart: {
-                WiPdmRbdGroupStartExtension extension = fromJson<decltype(extension)>(element->extension.value());
-                input = extension.input;
-            }
+            case PdmRoles::RbdGroupStart:
+                input = std::get<WiPdmRbdGroupStartExtension>(*decoded).input;
                 break;
             case PdmRoles::RbdGroupEnd:  // multiple inputs
                 ec = make_error_code(error::rbd_element_has_multiple_inputs);
@@ -4570,10 +7132,8 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             case PdmRoles::RbdGroupStart:
                 ec = make_error_code(error::rbd_element_has_single_input);
                 break;
-            case PdmRoles::RbdGroupEnd: {  // multiple inputs
-                WiPdmRbdGroupEndExtension extension = fromJson<decltype(extension)>(element->extension.value());
-                inputs = std::move(extension.inputs);
-            }
+            case PdmRoles::RbdGroupEnd:  // multiple inputs
+                inputs = std::get<WiPdmRbdGroupEndExtension>(*rbdExtension(element)).inputs;
                 break;
             default:
                 ec = make_error_code(error::not_an_rbd_element);
@@ -4602,26 +7162,19 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             return;
         }
 
+        auto decoded = rbdExtension(element);
         switch(element->role){
-            case PdmRoles::RbdInputNode: {
-                WiPdmRbdInputNodeExtension extension = fromJson<decltype(extension)>(element->extension.value());
-                output = extension.output;
-            }
+            case PdmRoles::RbdInputNode:
+                output = std::get<WiPdmRbdInputNodeExtension>(*decoded).output;
                 break;
-            case PdmRoles::RbdBlock: {
-                WiPdmRbdBlockExtension extension = fromJson<decltype(extension)>(element->extension.value());
-                output = extension.output;
-            }
+            case PdmRoles::RbdBlock:
+                output = std::get<WiPdmRbdBlockExtension>(*decoded).output;
                 break;
-            case PdmRoles::SubRbd: {
-                WiPdmSubRbdExtension extension = fromJson<decltype(extension)>(element->extension.value());
-                output = extension.output;
-            }
+            case PdmRoles::SubRbd:
+                output = std::get<WiPdmSubRbdExtension>(*decoded).output;
                 break;
-            case PdmRoles::RbdGroupEnd: {
-                WiPdmRbdGroupEndExtension extension = fromJson<decltype(extension)>(element->extension.value());
-                output = extension.output;
-            }
+            case PdmRoles::RbdGroupEnd:
+                output = std::get<WiPdmRbdGroupEndExtension>(*decoded).output;
                 break;
             case PdmRoles::RbdGroupStart: // multiple outputs
                 ec = make_error_code(error::rbd_element_has_multiple_outputs);
@@ -4658,10 +7211,8 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             case PdmRoles::RbdGroupEnd:
                 ec = make_error_code(error::rbd_element_has_single_output);
                 break;
-            case PdmRoles::RbdGroupStart:{ // multiple outputs
-                WiPdmRbdGroupStartExtension extension = fromJson<decltype(extension)>(element->extension.value());
-                outputs = extension.outputs;
-            }
+            case PdmRoles::RbdGroupStart: // multiple outputs
+                outputs = std::get<WiPdmRbdGroupStartExtension>(*rbdExtension(element)).outputs;
                 break;
             default:
                 ec = make_error_code(error::not_an_rbd_element);
@@ -4670,138 +7221,385 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
     }
 
     void PdmService::validateRbdGroup(
-            std::size_t initiatingService,
-            const WiRbdChain &group,
+            const details::RbdGraph &graph,
+            std::uint32_t start,
             bool validate,
+            boost::system::error_code &ec) const noexcept(true){
+        if(graph.nodes[start]->role != PdmRoles::RbdGroupStart){
+            ec = make_error_code(error::not_an_rbd_group);
+            return;
+        }
+        const auto end = graph.pairs[start];
+        if(end == details::RbdGraph::none){
+            ec = make_error_code(error::invalid_rbd_element);
+            return;
+        }
+        if(graph.nodes[end]->role != PdmRoles::RbdGroupEnd){
+            ec = make_error_code(error::not_an_rbd_group);
+            return;
+        }
+        if(graph.pairs[end] != start){
+            ec = make_error_code(error::invalid_rbd_group);
+            return;
+        }
+
+        if(graph.inDegree(end) != graph.outDegree(start)){
+            ec = make_error_code(error::rbd_group_is_not_traceable);
+            return;
+        }
+
+        if(validate && graph.inDegree(end) == 1){
+            ec = make_error_code(error::rbd_group_contains_one_chain_only);
+            return;
+        }
+    }
+
+    void PdmService::validateRbdChain(
+            const details::RbdGraph &graph,
+            const WiRbdChain &chain,
+            bool open,
+            boost::system::error_code &ec) const noexcept(true){
+        auto curr = graph.find(chain.source);
+        const auto last = graph.find(chain.target);
+        if(curr == details::RbdGraph::none || last == details::RbdGraph::none){
+            ec = make_error_code(error::invalid_rbd_chain);
+            return;
+        }
+        if(open && (graph.inDegree(curr) != 0 || graph.outDegree(last) != 0)){
+            ec = make_error_code(error::rbd_chain_is_not_detached);
+            return;
+        }
+        // цепочка длиннее числа узлов схемы - в связях цикл
+        for(std::size_t steps = 0; curr != last; ++steps){
+            if(curr == details::RbdGraph::none || steps > graph.nodes.size()){
+                ec = make_error_code(error::invalid_rbd_chain);
+                return;
+            }
+            switch(graph.nodes[curr]->role){
+                case PdmRoles::RbdGroupStart:
+                    validateRbdGroup(graph, curr, false, ec);
+                    if(ec) return;
+                    curr = graph.pairs[curr];
+                    break;
+                case PdmRoles::RbdOutputNode:
+                    ec = make_error_code(error::invalid_rbd_chain);
+                    return;
+                case PdmRoles::RbdInputNode:
+                case PdmRoles::RbdBlock:
+                case PdmRoles::SubRbd:
+                case PdmRoles::RbdGroupEnd:
+                    if(graph.outDegree(curr) != 1){
+                        ec = make_error_code(error::invalid_rbd_chain);
+                        return;
+                    }
+                    curr = graph.output(curr);
+                    break;
+                default:
+                    ec = make_error_code(error::not_an_rbd_element);
+                    return;
+            }
+        }
+    }
+
+    void PdmService::checkRbdEdit(
+            std::size_t initiatingService,
+            const std::string &schema,
+            const std::vector<WiRbdViolation> &before,
+            const std::shared_ptr<IWiSession> sessionPtr,
+            boost::system::error_code &ec,
+            const net::yield_context &yield,
+            std::shared_ptr<MethodContextInterface> ctx) const noexcept(true){
+        GUARD_PDM_METHOD();
+        auto graph = getRbdGraph(initiatingService, schema, sessionPtr, ec, yield, mctx);
+        if(ec || !graph) return;
+        std::vector<WiRbdViolation> after;
+        validateRbdGraph(graph.value(), after);
+        // недостроенная схема может уже иметь нарушения, ошибка - только новые
+        std::set<std::tuple<std::string, std::int32_t, std::string>> known;
+        for(const auto &v:before) {
+            known.emplace(v.semantic, v.code, v.reason);
+        }
+        for(const auto &v:after) {
+            if(!known.count(std::make_tuple(v.semantic, v.code, v.reason))) {
+                WI_LOG_DEBUG() << "RBD EDIT BROKE SCHEMA " << schema << ": " << v.semantic << " " << v.reason;
+                ec = make_error_code(static_cast<error::code>(v.code));
+                return;
+            }
+        }
+    }
+
+    std::optional<WiRbdValidationResult> PdmService::validateRbdSchema(
+            std::size_t initiatingService,
+            const WiSemanticOnlyQuery &query,
             const std::shared_ptr<IWiSession> sessionPtr,
             boost::system::error_code &ec,
             const net::yield_context &yield,
             std::shared_ptr<MethodContextInterface> ctx) const noexcept(true){
         GUARD_PDM_METHOD();
-        boost::ignore_unused(initiatingService,group,sessionPtr);
-        auto start_node = fetchRawNodeEntity(initiatingService,group.source,sessionPtr,ec,yield,mctx);
-        if(ec) return;
-        if(start_node->role != PdmRoles::RbdGroupStart){
-            ec = make_error_code(error::not_an_rbd_group);
-            return;
-        }
-        auto end_node = fetchRawNodeEntity(initiatingService,group.target,sessionPtr,ec,yield,mctx);
-        if(ec) return;
-        if(start_node->role != PdmRoles::RbdGroupEnd){
-            ec = make_error_code(error::not_an_rbd_group);
-            return;
-        }
+        checkNode(initiatingService, query.semantic, PdmRoles::RbdSchema, sessionPtr, ec, yield, mctx);
+        if(ec) return std::nullopt;
 
-        if(!start_node->extension.has_value()){
-            ec = make_error_code(error::invalid_rbd_element);
-            return;
-        }
-        if(!end_node->extension.has_value()){
-            ec = make_error_code(error::invalid_rbd_element);
-            return;
+        auto graph = getRbdGraph(initiatingService, query.semantic, sessionPtr, ec, yield, mctx);
+        if(ec || !graph) return std::nullopt;
+
+        WiRbdValidationResult result;
+        validateRbdGraph(graph.value(), result.violations);
+        return result;
+    }
+
+    void PdmService::validateRbdGraph(
+            const details::RbdGraph &graph,
+            std::vector<WiRbdViolation> &violations) const noexcept(true){
+        constexpr auto none = details::RbdGraph::none;
+        const auto n = static_cast<std::uint32_t>(graph.nodes.size());
+        auto violation = [&](std::uint32_t i, error::code code, const char *reason) {
+            WiRbdViolation v;
+            if(i != none) v.semantic = graph.nodes[i]->semantic;
+            v.code = make_error_code(code).value();
+            v.reason = reason;
+            violations.push_back(std::move(v));
+        };
+
+        auto input = none;
+        auto output = none;
+        // все связи в виде ключей источник-приемник, для проверки взаимности за O(E)
+        auto key = [](std::uint32_t from, std::uint32_t to) { return (std::uint64_t(from) << 32) | to; };
+        std::unordered_set<std::uint64_t> inputs;
+        std::unordered_set<std::uint64_t> outputs;
+        for(std::uint32_t i = 0; i < n; ++i) {
+            for(std::uint32_t j = 0; j < graph.inDegree(i); ++j) {
+                if(graph.input(i, j) != none) inputs.insert(key(graph.input(i, j), i));
+            }
+            for(std::uint32_t j = 0; j < graph.outDegree(i); ++j) {
+                if(graph.output(i, j) != none) outputs.insert(key(i, graph.output(i, j)));
+            }
+        }
+
+        for(std::uint32_t i = 0; i < n; ++i) {
+            const auto role = graph.nodes[i]->role;
+            bool single_input = false;
+            bool single_output = false;
+            switch(role){
+                case PdmRoles::RbdInputNode:
+                    if(input != none) violation(i, error::invalid_rbd_chain, "multiple input nodes");
+                    input = i;
+                    single_output = true;
+                    break;
+                case PdmRoles::RbdOutputNode:
+                    if(output != none) violation(i, error::invalid_rbd_chain, "multiple output nodes");
+                    output = i;
+                    single_input = true;
+                    break;
+                case PdmRoles::RbdBlock:
+                case PdmRoles::SubRbd:
+                    single_input = single_output = true;
+                    break;
+                case PdmRoles::RbdGroupStart: {
+                    single_input = true;
+                    const auto end = graph.pairs[i];
+                    if(end == none || graph.nodes[end]->role != PdmRoles::RbdGroupEnd || graph.pairs[end] != i) {
+                        violation(i, error::invalid_rbd_group, "group start has no matching end");
+                    } else if(graph.inDegree(end) != graph.outDegree(i)) {
+                        violation(i, error::rbd_group_is_not_traceable, "group branch count mismatch");
+                    }
+                    if(graph.outDegree(i) == 0) violation(i, error::invalid_rbd_element, "dangling output");
+                }
+                    break;
+                case PdmRoles::RbdGroupEnd: {
+                    single_output = true;
+                    const auto start = graph.pairs[i];
+                    if(start == none || graph.nodes[start]->role != PdmRoles::RbdGroupStart || graph.pairs[start] != i) {
+                        violation(i, error::invalid_rbd_group, "group end has no matching start");
+                    }
+                    if(graph.inDegree(i) == 0) violation(i, error::invalid_rbd_element, "dangling input");
+                }
+                    break;
+                default:
+                    continue;
+            }
+            if(single_input && graph.inDegree(i) != 1) violation(i, error::invalid_rbd_element, "dangling input");
+            if(single_output && graph.outDegree(i) != 1) violation(i, error::invalid_rbd_element, "dangling output");
+
+            for(std::uint32_t j = 0; j < graph.inDegree(i); ++j) {
+                const auto from = graph.input(i, j);
+                if(from == none) {
+                    violation(i, error::invalid_rbd_element, "input outside schema");
+                } else if(!outputs.count(key(from, i))) {
+                    violation(i, error::rbd_elements_are_not_connected, "input not linked back as output");
+                }
+            }
+            for(std::uint32_t j = 0; j < graph.outDegree(i); ++j) {
+                const auto to = graph.output(i, j);
+                if(to == none) {
+                    violation(i, error::invalid_rbd_element, "output outside schema");
+                } else if(!inputs.count(key(i, to))) {
+                    violation(i, error::rbd_elements_are_not_connected, "output not linked back as input");
+                }
+            }
         }
 
-        WiPdmRbdGroupStartExtension start_ext = fromJson<decltype(start_ext)>(start_node->extension.value());
-        WiPdmRbdGroupEndExtension end_ext = fromJson<decltype(end_ext)>(end_node->extension.value());
+        if(input == none) violation(none, error::invalid_rbd_chain, "no input node");
+        if(output == none) violation(none, error::invalid_rbd_chain, "no output node");
 
-        if(!start_ext.end.has_value()){
-            ec = make_error_code(error::invalid_rbd_element);
-            return;
+        // достижимость от входа
+        std::vector<bool> reached(n, false);
+        std::vector<std::uint32_t> queue;
+        queue.reserve(n);
+        if(input != none) {
+            reached[input] = true;
+            queue.push_back(input);
         }
-        if(!end_ext.start.has_value()){
-            ec = make_error_code(error::invalid_rbd_element);
-            return;
+        for(std::size_t head = 0; head < queue.size(); ++head) {
+            const auto i = queue[head];
+            for(std::uint32_t j = 0; j < graph.outDegree(i); ++j) {
+                const auto to = graph.output(i, j);
+                if(to != none && !reached[to]) {
+                    reached[to] = true;
+                    queue.push_back(to);
+                }
+            }
         }
 
-        if(end_ext.start.value() != start_node->semantic){
-            ec = make_error_code(error::invalid_rbd_group);
-            return;
+        // циклы: после алгоритма Кана в цикле остаются узлы с ненулевой полустепенью захода
+        std::vector<std::uint32_t> pending(n, 0);
+        for(std::uint32_t i = 0; i < n; ++i) {
+            for(std::uint32_t j = 0; j < graph.outDegree(i); ++j) {
+                if(graph.output(i, j) != none) ++pending[graph.output(i, j)];
+            }
         }
-        if(start_ext.end.value() != end_node->semantic){
-            ec = make_error_code(error::invalid_rbd_group);
-            return;
+        queue.clear();
+        for(std::uint32_t i = 0; i < n; ++i) {
+            if(pending[i] == 0) queue.push_back(i);
         }
-
-        if(end_ext.inputs.size() != start_ext.outputs.size()){
-            ec = make_error_code(error::rbd_group_is_not_traceable);
-            return;
+        for(std::size_t head = 0; head < queue.size(); ++head) {
+            const auto i = queue[head];
+            for(std::uint32_t j = 0; j < graph.outDegree(i); ++j) {
+                const auto to = graph.output(i, j);
+                if(to != none && --pending[to] == 0) queue.push_back(to);
+            }
         }
 
-        if(validate && end_ext.inputs.size() == 1){
-            ec = make_error_code(error::rbd_group_contains_one_chain_only);
-            return;
+        for(std::uint32_t i = 0; i < n; ++i) {
+            switch(graph.nodes[i]->role){
+                case PdmRoles::RbdInputNode:
+                case PdmRoles::RbdOutputNode:
+                case PdmRoles::RbdBlock:
+                case PdmRoles::SubRbd:
+                case PdmRoles::RbdGroupStart:
+                case PdmRoles::RbdGroupEnd:
+                    break;
+                default:
+                    continue;
+            }
+            if(pending[i] != 0) violation(i, error::invalid_rbd_chain, "element is on a cycle");
+            if(input != none && !reached[i]) violation(i, error::invalid_rbd_chain, "unreachable from input");
         }
-
-        // todo: trace all group branches
-
-        return;
     }
 
-    void PdmService::validateRbdChain(
-            std::size_t initiatingService,
-            const WiRbdChain &chain,
-            bool open,
-            const std::shared_ptr<IWiSession> sessionPtr,
-            boost::system::error_code &ec,
-            const net::yield_context &yield,
-            std::shared_ptr<MethodContextInterface> ctx) const noexcept(true){
-        GUARD_PDM_METHOD();
-        auto source = fetchRawNodeEntity(initiatingService,chain.source,sessionPtr, ec,yield,mctx);
-        if(!source || ec) return;
-        auto target = fetchRawNodeEntity(initiatingService,chain.target,sessionPtr, ec,yield,mctx);
-        if(!target || ec) return;
-        {
-            std::optional<std::string> input, output;
-            getRbdElementInput(
-                initiatingService,
-                source,
-                input,
-                sessionPtr,
-                ec,
-                yield,
-                mctx);
-            if (ec) return;
-            getRbdElementOutput(
-                initiatingService,
-                target,
-                output,
-                sessionPtr,
-                ec,
-                yield,
-                mctx);
-            if (ec) return;
-            if (open) {
-                if(input.has_value() || output.has_value()){
-                    ec = make_error_code(error::rbd_chain_is_not_detached);
-                    return;
-                }
+    bool PdmService::checkRbdKnownAnswers() const noexcept(true) {
+        bool passed = true;
+        auto expect = [&passed](const char *name, const std::optional<Number> &value, const Number &expected) {
+            if(value.has_value() && abs(value.value() - expected) <= abs(expected) / 1000000000_Nr) return;
+            passed = false;
+            if(value.has_value()) {
+                WI_LOG_ERROR() << "RBD KNOWN ANSWER MISMATCH " << name << ": " << value.value() << " != " << expected;
             }
-        }
-        auto curr = source;
-        while(curr->semantic != target->semantic){
-            if (curr->role == PdmRoles::RbdGroupStart){
-                auto res = getRbdGroup(initiatingService, curr->semantic, sessionPtr,ec,yield,mctx);
-                if(!res || ec) return;
-                curr = fetchRawNodeEntity(initiatingService,res.value().target,sessionPtr,ec,yield,mctx);
-                if(!curr || ec) return;
-                validateRbdGroup(initiatingService,res.value(), false,sessionPtr,ec,yield,mctx);
-                if(ec) return;
-            }else if(curr->role == PdmRoles::RbdOutputNode) {
-                ec = make_error_code(error::invalid_rbd_chain);
-                return;
-            } else {
-                std::optional<std::string> output;
-                getRbdElementOutput(initiatingService,curr,output,sessionPtr,ec,yield,mctx);
-                if(ec) return;
-                if (!output.has_value()){
-                    ec = make_error_code(error::invalid_rbd_chain);
-                    return;
-                }
-                curr = fetchRawNodeEntity(initiatingService,output.value(),sessionPtr,ec,yield,mctx);
-                if(!curr || ec) return;
+            else {
+                WI_LOG_ERROR() << "RBD KNOWN ANSWER MISMATCH " << name << ": no value";
             }
+        };
+        // R(t) и наработка: точная, аналитическая и прежняя квадратура getRbdChainModel должны совпасть
+        const Number t = 100_Nr;
+        auto check = [&](const char *name, RbdModel &&model, const Number &reliability, const Number &mtbf) {
+            expect(name, model.calculate(t), reliability);
+            expect(name, model.integrate(rbd_closed_form_max_terms), mtbf);
+            auto f = [&model](Number s) {
+                auto r = model.calculate(s);
+                return r.has_value() && isfinite(r.value()) ? r.value() : 0_Nr;
+            };
+            expect(name, boost::math::quadrature::exp_sinh<Number>().integrate(f), mtbf);
+        };
+        auto leaf = [](const Number &rate, const char *ref) {
+            return details::RBDPartModel(details::Node(rate, ref, ref));
+        };
+        const Number l = 1_Nr / 1000_Nr;
+        const Number p = exp(-l * t);
+
+        // последовательно: интенсивности складываются
+        check("series", RbdModel(rbdChain(rbdParts(leaf(l, "a"), leaf(2_Nr * l, "b")))),
+              exp(-3_Nr * l * t), 1_Nr / (3_Nr * l));
+        // параллельно: 1/l1 + 1/l2 - 1/(l1 + l2)
+        check("parallel", RbdModel(rbdGroup(rbdParts(leaf(l, "a"), leaf(2_Nr * l, "b")))),
+              1_Nr - (1_Nr - p) * (1_Nr - p * p), 1_Nr / l + 1_Nr / (2_Nr * l) - 1_Nr / (3_Nr * l));
+        // 2 из 3: R = 3p^2 - 2p^3, наработка 5/(6l)
+        check("2-of-3", RbdModel(rbdGroup(rbdParts(leaf(l, "a"), leaf(l, "b"), leaf(l, "c")), 2)),
+              3_Nr * p * p - 2_Nr * p * p * p, 5_Nr / (6_Nr * l));
+        // мостик a-d, b-e, перемычка c: пути ad, be, ace, bcd с повторяющимися компонентами, считается по BDD.
+        // R = 2p^2 + 2p^3 - 5p^4 + 2p^5
+        auto bridge = [&]() {
+            return rbdGroup(rbdParts(rbdChain(rbdParts(leaf(l, "a"), leaf(l, "d"))),
+                                     rbdChain(rbdParts(leaf(l, "b"), leaf(l, "e"))),
+                                     rbdChain(rbdParts(leaf(l, "a"), leaf(l, "c"), leaf(l, "e"))),
+                                     rbdChain(rbdParts(leaf(l, "b"), leaf(l, "c"), leaf(l, "d")))));
+        };
+        const Number p2 = p * p;
+        check("bridge", RbdModel(bridge()),
+              2_Nr * p2 + 2_Nr * p2 * p - 5_Nr * p2 * p2 + 2_Nr * p2 * p2 * p,
+              (1_Nr + 2_Nr / 3_Nr - 5_Nr / 4_Nr + 2_Nr / 5_Nr) / l);
+        // BDD не уложилась в предел: повторяющиеся компоненты считаются независимыми
+        {
+            RbdModel overflow(bridge(), 3);
+            if(!overflow.program().bdd.empty()) {
+                passed = false;
+                WI_LOG_ERROR() << "RBD KNOWN ANSWER MISMATCH bdd overflow: diagram is kept";
+            }
+            const Number q = (1_Nr - p2) * (1_Nr - p2 * p);
+            expect("bdd overflow", overflow.calculate(t), 1_Nr - q * q);
+        }
+
+        // граф вход -> a -> b -> выход: без нарушений; b -> a вместо b -> выход замыкает цикл, который оставляет алгоритм Кана
+        constexpr auto none = details::RbdGraph::none;
+        auto graph = [](const std::vector<std::pair<std::uint32_t, std::uint32_t>> &links) {
+            const std::vector<std::int32_t> roles = {PdmRoles::RbdInputNode, PdmRoles::RbdBlock, PdmRoles::RbdBlock, PdmRoles::RbdOutputNode};
+            details::RbdGraph g;
+            for(std::uint32_t i = 0; i < roles.size(); ++i) {
+                auto node = std::make_shared<WiPdmRawNodeEntity>();
+                node->role = roles[i];
+                node->semantic = std::to_string(i);
+                g.ids.emplace(node->semantic, i);
+                g.nodes.push_back(std::move(node));
+            }
+            const auto n = static_cast<std::uint32_t>(roles.size());
+            g.pairs.assign(n, none);
+            for(std::uint32_t i = 0; i <= n; ++i) {
+                g.outOffsets.push_back(static_cast<std::uint32_t>(g.outs.size()));
+                g.inOffsets.push_back(static_cast<std::uint32_t>(g.ins.size()));
+                if(i == n) break;
+                for(const auto &[from, to]:links) {
+                    if(from == i) g.outs.push_back(to);
+                    if(to == i) g.ins.push_back(from);
+                }
+            }
+            return g;
+        };
+        auto onCycle = [](const std::vector<WiRbdViolation> &violations, const std::string &semantic) {
+            return std::any_of(violations.begin(), violations.end(), [&semantic](const WiRbdViolation &v) {
+                return v.semantic == semantic && v.reason == std::string("element is on a cycle");
+            });
+        };
+        std::vector<WiRbdViolation> violations;
+        validateRbdGraph(graph({{0, 1}, {1, 2}, {2, 3}}), violations);
+        if(!violations.empty()) {
+            passed = false;
+            WI_LOG_ERROR() << "RBD KNOWN ANSWER MISMATCH chain: " << violations.size() << " violations";
         }
-        return;
+        violations.clear();
+        validateRbdGraph(graph({{0, 1}, {1, 2}, {2, 1}}), violations);
+        if(!onCycle(violations, "1") || !onCycle(violations, "2") || onCycle(violations, "0")) {
+            passed = false;
+            WI_LOG_ERROR() << "RBD KNOWN ANSWER MISMATCH cycle: cycle is not reported";
+        }
+        return passed;
     }
 
     void PdmService::checkRbdLinkExists(
@@ -5425,10 +8223,21 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
 
         if (ec) return;
 
+        auto schema = parentSemantic(query.semantic, ec);
+        if (ec) return;
+        std::vector<WiRbdViolation> violations;
+        {
+            auto graph = getRbdGraph(initiatingService, schema, sessionPtr, ec, yield, mctx);
+            if (ec || !graph) return;
+            validateRbdGraph(graph.value(), violations);
+            if (query.chain.has_value()) {
+                validateRbdChain(graph.value(), query.chain.value(), true, ec);
+                if (ec) return;
+            }
+        }
+
         WiRbdChain chain;
         if (query.chain.has_value()) {
-            validateRbdChain(initiatingService,query.chain.value(),true,sessionPtr,ec,yield,mctx);
-            if (ec) return;
             chain = query.chain.value();
         } else if (query.blocks.has_value()) {
             auto rbd = nodeNearestAncestor(initiatingService, query.semantic, PdmRoles::RbdSchema, 1, sessionPtr, ec, yield, mctx);
@@ -5488,9 +8297,8 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
                     ||(PdmRoles::RbdBlock == linkToNode->role && PdmRoles::RbdBlock == targetNode->role)
                     ||(PdmRoles::RbdGroupEnd == linkToNode->role && PdmRoles::RbdBlock == targetNode->role)) {
                 insertRbdBetween(initiatingService, link, chain, sessionPtr,ec, yield,mctx);
-                return;
             }
-            if ((PdmRoles::RbdInputNode == targetNode->role || PdmRoles::RbdOutputNode == targetNode->role) //Если это вход/выход схемы
+            else if ((PdmRoles::RbdInputNode == targetNode->role || PdmRoles::RbdOutputNode == targetNode->role) //Если это вход/выход схемы
                     ||(PdmRoles::RbdInputNode == linkToNode->role || PdmRoles::RbdOutputNode == linkToNode->role)
                     ||(PdmRoles::RbdGroupStart == linkToNode->role && PdmRoles::RbdGroupEnd == targetNode->role)  //Если выставляем между узлами групп
                     ||(PdmRoles::RbdGroupEnd == linkToNode->role && PdmRoles::RbdGroupStart == targetNode->role)) {     //Если выставляем между узлами групп
@@ -5513,8 +8321,9 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             }
 
             addRbdLink(initiatingService, link, sessionPtr, ec, yield, mctx);
-            if(ec) return;
         }
+        if(ec) return;
+        checkRbdEdit(initiatingService, schema, violations, sessionPtr, ec, yield, mctx);
     }
 
     void PdmService::validateInsertRbdInParallelQuery(
@@ -5541,6 +8350,15 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         checkNode(initiatingService, query.semantic, PdmRoles::RbdBlock, sessionPtr,  ec, yield, mctx);
         if (ec) return;
 
+        auto schema = parentSemantic(query.semantic, ec);
+        if (ec) return;
+        std::vector<WiRbdViolation> violations;
+        {
+            auto graph = getRbdGraph(initiatingService, schema, sessionPtr, ec, yield, mctx);
+            if (ec || !graph) return;
+            validateRbdGraph(graph.value(), violations);
+        }
+
         // Нода относительно которой будем вставлять узлы
         auto currentElement = fetchRawNodeEntity( initiatingService, query.semantic, sessionPtr,ec,yield,mctx);
         if (!currentElement->extension.has_value()) {
@@ -5682,6 +8500,9 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         update_right_node_query.extension = toJson(rightNodeExtension);
         update_right_node_query.updateExtension = true;
         updateNode(initiatingService, update_right_node_query, sessionPtr, Filter::filterOn, ec, yield, mctx);
+        if (ec) return;
+        checkRbdEdit(initiatingService, schema, violations, sessionPtr, ec, yield, mctx);
+        if (ec) return;
         mctx.addSchemaTrigger(rbdNode.semantic);
         mctx.addSchemaFlagsTrigger(rbdNode.semantic);
     }
@@ -5737,6 +8558,8 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         }
 
         auto &failureTypesCache = PlainCache.getEntitiesCache<WiPdmFailureType>();
+        // ссылки видов отказа и сам элемент записываются одним updateNodes в конце
+        std::vector<WiUpdatePdmNodeQuery> updates;
 
         WiPdmElementData elementData;
         if (element->entity.has_value()) {
@@ -5789,7 +8612,7 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
                     updateFailureTypeQuery.data = toJson(data);
                     updateFailureTypeQuery.updateData = true;
                     updateFailureTypeQuery.semantic = entity.semantic;
-                    updateNode(initiatingService, updateFailureTypeQuery, sessionPtr, Filter::filterOn, ec, yield, mctx);
+                    updates.push_back(std::move(updateFailureTypeQuery));
                 });
             }
         }
@@ -5822,7 +8645,7 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
                     updateFailureTypeQuery.semantic = changedFailureType.semantic;
                     updateFailureTypeQuery.data = toJson(data);
                     updateFailureTypeQuery.updateData = true;
-                    updateNode(initiatingService, updateFailureTypeQuery, sessionPtr, Filter::filterOn, ec, yield, mctx);
+                    updates.push_back(std::move(updateFailureTypeQuery));
                 });
 
                 auto it = std::find_if(elementFailureTypes.begin(), elementFailureTypes.end(), [&entityToUpdate](const WiPdmElementFailureType &failureType) {
@@ -5868,13 +8691,16 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             }
         }
 
+        if (ec) return;
+
         elementData.failure_types = elementFailureTypes;
         WiUpdatePdmNodeQuery updateElementQuery;
         updateElementQuery.semantic = element->semantic;
         updateElementQuery.data = toJson(elementData);
         updateElementQuery.updateData = true;
+        updates.push_back(std::move(updateElementQuery));
 
-        updateNode(initiatingService, updateElementQuery, sessionPtr, Filter::filterOn, ec, yield, mctx);
+        updateNodes(initiatingService, updates, sessionPtr, Filter::filterOn, ec, yield, mctx);
     }
 
     void PdmService::removeElementFailureTypes(
@@ -5913,6 +8739,7 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         }
 
         auto &failureTypesCache = PlainCache.getEntitiesCache<WiPdmFailureType>();
+        std::vector<WiUpdatePdmNodeQuery> updates;
 
         for (const auto &semantic : failureTypesToDelete) {
             //  обновляем список ссылок типа отказа на элементы и удаляем тип отказа если ссылок не осталось
@@ -5945,9 +8772,11 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
                 updateFailureTypeQuery.data = toJson(data);
                 updateFailureTypeQuery.updateData = true;
                 updateFailureTypeQuery.semantic = entity.semantic;
-                updateNode(initiatingService, updateFailureTypeQuery, sessionPtr, Filter::filterOn, ec, yield, mctx);
+                updates.push_back(std::move(updateFailureTypeQuery));
             });
         }
+        if (ec) return;
+        updateNodes(initiatingService, updates, sessionPtr, Filter::filterOn, ec, yield, mctx);
     }
 
     void PdmService::updateElementSemanticInFailureTypeCache(
@@ -5960,9 +8789,12 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             std::shared_ptr<MethodContextInterface> ctx) const noexcept(true) {
         GUARD_PDM_METHOD();
         auto &failureTypesCache = PlainCache.getEntitiesCache<WiPdmFailureType>();
+        std::vector<WiUpdatePdmNodeQuery> updates;
 
         for (auto &failureType : failureTypesCache.getEntitiesByProject(projectSemanticByNodeSemantic(oldSemantic))) {
             auto &refs = failureType.refs;
+            // виды отказа без ссылки на элемент не переписываем
+            if (std::find(refs.begin(), refs.end(), oldSemantic) == refs.end()) continue;
             std::replace_if(refs.begin(), refs.end(),
                 [&oldSemantic] (const std::string &semantic) {return semantic == oldSemantic;}, newSemantic);
 
@@ -5974,10 +8806,10 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
                 updateFailureTypeQuery.semantic = entity.semantic;
                 updateFailureTypeQuery.data = toJson(data);
                 updateFailureTypeQuery.updateData = true;
-
-                updateNode(initiatingService, updateFailureTypeQuery, sessionPtr, Filter::filterOn, ec, yield, mctx);
+                updates.push_back(std::move(updateFailureTypeQuery));
             });
         }
+        updateNodes(initiatingService, updates, sessionPtr, Filter::filterOn, ec, yield, mctx);
     }
 
     void PdmService::insertRbdInParallel(
@@ -6001,6 +8833,17 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
                                        mctx);
         if (ec) return;
 
+        std::vector<WiRbdViolation> violations;
+        {
+            auto graph = getRbdGraph(initiatingService, rbd.semantic, sessionPtr, ec, yield, mctx);
+            if (ec || !graph) return;
+            validateRbdGraph(graph.value(), violations);
+            if (query.chain.has_value()) {
+                validateRbdChain(graph.value(), query.chain.value(), true, ec);
+                if (ec) return;
+            }
+        }
+
         // left = chain.start.input, right = chain.end.output
         // получаем ноды к которым у нас цепочка была подключена перед тем как ее detach(вырвать)
         std::optional<std::string> left,right;
@@ -6024,8 +8867,6 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         if(query.position){
             //Вставка в начало(сверху)
             if (query.chain.has_value()) {
-                validateRbdChain(initiatingService, query.chain.value(), true, sessionPtr, ec, yield, mctx);
-                if (ec) return;
                 {
                     auto group_res = createRbdGroup(initiatingService, rbd.semantic, sessionPtr, ec, yield, mctx);
                     if(!group_res.has_value() || ec) return;
@@ -6065,8 +8906,6 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             if (ec) return;
 
             if (query.chain.has_value()) {
-                validateRbdChain(initiatingService, query.chain.value(), true, sessionPtr, ec, yield, mctx);
-                if (ec) return;
                 insertRbdChainIntoGroup(initiatingService, group, query.chain.value(), sessionPtr,ec,yield,mctx);
                 if (ec) return;
             }
@@ -6101,6 +8940,7 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             addRbdLink(initiatingService, groupToRight, sessionPtr, ec, yield, mctx);
             if (ec) return;
         }
+        checkRbdEdit(initiatingService, rbd.semantic, violations, sessionPtr, ec, yield, mctx);
     }
 
     std::optional<WiRbdChain> PdmService::createRbdGroup(
@@ -6185,7 +9025,11 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             return;
         }
         if(validateChain){
-            validateRbdChain(initiatingService, query, false, sessionPtr, ec, yield, mctx);
+            auto schema = parentSemantic(query.source, ec);
+            if (ec) return;
+            auto graph = getRbdGraph(initiatingService, schema, sessionPtr, ec, yield, mctx);
+            if (ec || !graph) return;
+            validateRbdChain(graph.value(), query, false, ec);
             if (ec) return;
         }
         // получаем ноды к которым у нас цепочка была подключена перед тем как ее detach(вырвать)
@@ -6742,20 +9586,8 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             return;
         }
 
-        long int productLifeTime{};
-        WiPdmElementData data = fromJson<WiPdmElementData>(productEntity.data.value());
-        if (data.ster.has_value()) {
-            auto it = data.ster->data.find("expected_life_time");
-            if (it != data.ster->data.end()) {
-                auto gen_val = std::get_if<WiValueGeneral>(&it->second.value);
-                if (gen_val != nullptr) {
-                    auto val = std::get_if<std::optional<long double>>(gen_val);
-                    if (val != nullptr && val->has_value()) {
-                        productLifeTime = val->value();
-                    }
-                }
-            }
-        }
+        long int productLifeTime = static_cast<long int>(
+                productExpectedLifeTime(fromJson<WiPdmElementData>(productEntity.data.value())).value_or(0));
 
         auto scheme = nodeNearestAncestor(initiatingService, RBDBlockNode->semantic, PdmRoles::RbdSchema,1, sessionPtr,ec, yield,mctx);
         if (ec) return;
@@ -6788,6 +9620,7 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         else { // Иначе необходимо пересчитать переменные с учетом времени работы схемы
             vars.failure_rate = componentVariables.failure_rate;
             fillAllVars(vars, schemeLifeTime,ec);
+            if (ec) return;
         }
 
         WiUpdatePdmNodeQuery updateRBDQuery(*RBDBlockNode);
@@ -6799,9 +9632,170 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         updateRBDQuery.semantic        = RBDBlockSemantic;
 
         updateNode(initiatingService, updateRBDQuery, sessionPtr, Filter::filterOn, ec, yield, mctx);
+        if (!ec) {
+            patchRbdModelLeaf(scheme.semantic, RBDBlockSemantic, vars.failure_rate, mctx);
+        }
         initiateRecalculation(initiatingService, sessionPtr, RBDBlockSemantic,ec, yield,mctx);
     }
 
+    void PdmService::fillRbdBlocksVars(
+            std::size_t initiatingService,
+            std::shared_ptr<WiPdmRawNodeEntity> schema,
+            const std::vector<std::shared_ptr<WiPdmRawNodeEntity>> &blocks,
+            const std::optional<long double> &timespan,
+            bool &withoutParameters,
+            const std::shared_ptr<IWiSession> sessionPtr,
+            boost::system::error_code &ec,
+            const boost::asio::yield_context &yield,
+            std::shared_ptr<MethodContextInterface> ctx) const noexcept(true) {
+        GUARD_PDM_METHOD();
+        withoutParameters = false;
+        if (blocks.empty()) return;
+
+        // время работы изделия по родителю компонента, компоненты одного узла дерева лежат в одном изделии
+        std::map<std::string, long int> productLifeTimes;
+        auto productLifeTime = [&](const std::string &component, boost::system::error_code &lec) -> std::optional<long int> {
+            std::string parent = parentSemantic(component, lec);
+            if (lec) return std::nullopt;
+            if (auto it = productLifeTimes.find(parent); it != productLifeTimes.end()) {
+                return it->second;
+            }
+            auto product = nodeNearestAncestor(initiatingService, component, PdmRoles::Product, 1, sessionPtr, lec, yield, mctx);
+            if (lec) return std::nullopt;
+
+            auto productNodeEntity = fetchRawNodeEntity(initiatingService, product.semantic, sessionPtr, lec, yield, mctx);
+            if (lec || !productNodeEntity) return std::nullopt;
+
+            if (!productNodeEntity->entity.has_value() || !productNodeEntity->entity->data.has_value()) {
+                return std::nullopt;
+            }
+
+            long int lifeTime = static_cast<long int>(
+                    productExpectedLifeTime(fromJson<WiPdmElementData>(productNodeEntity->entity->data.value())).value_or(0));
+            productLifeTimes.emplace(parent, lifeTime);
+            return lifeTime;
+        };
+
+        // Компоненты читаются по одному, а родитель, на которого ссылается много блоков, читается слоем:
+        // выборки по списку семантик у слоя данных нет
+        std::map<std::string, std::shared_ptr<WiPdmRawNodeEntity>> components;
+        {
+            std::map<std::string, std::set<std::string>> byParent;
+            for (const auto &block : blocks) {
+                if (block->role != PdmRoles::RbdBlock || !block->extension.has_value()) continue;
+                const auto decoded = rbdExtension(block);
+                const auto &extension = std::get<WiPdmRbdBlockExtension>(*decoded);
+                if (!extension.ref.has_value()) continue;
+                std::string parent = parentSemantic(extension.ref.value(), ec);
+                if (ec) return;
+                byParent[parent].insert(extension.ref.value());
+            }
+            for (const auto &[parent, refs] : byParent) {
+                if (refs.size() < rbd_components_layer_min) continue;
+                WiPdmRawNodeEntity::Container layer;
+                fetchRawNodesEntity(initiatingService, parent, layer, sessionPtr, ec, yield, mctx);
+                if (ec) return;
+                for (auto &node : layer) {
+                    if (refs.count(node.semantic)) {
+                        auto semantic = node.semantic;
+                        components.emplace(std::move(semantic), std::make_shared<WiPdmRawNodeEntity>(std::move(node)));
+                    }
+                }
+            }
+        }
+        std::vector<WiUpdatePdmNodeQuery> updates;
+        std::vector<std::pair<std::string, std::optional<Number>>> rates;
+        for (const auto &block : blocks) {
+            if (block->role != PdmRoles::RbdBlock || !block->extension.has_value()) continue;
+            const auto decoded = rbdExtension(block);
+            const auto &extension = std::get<WiPdmRbdBlockExtension>(*decoded);
+            if (!extension.ref.has_value()) continue;
+
+            // повторные ссылки на один компонент не перечитываем
+            // битый блок не валит схему: он пропускается и отмечается флагом параметров
+            auto found = components.find(extension.ref.value());
+            if (found == components.end()) {
+                boost::system::error_code fec;
+                auto component = fetchRawNodeEntity(initiatingService, extension.ref.value(), sessionPtr, fec, yield, mctx);
+                found = components.emplace(extension.ref.value(), fec ? nullptr : std::move(component)).first;
+            }
+            const auto &component = found->second;
+            if (!component) {
+                withoutParameters = true;
+                continue;
+            }
+
+            if (component->role != PdmRoles::ProxyComponent &&
+                component->role != PdmRoles::ElectricComponent &&
+                component->role != PdmRoles::Container) {
+                withoutParameters = true;
+                continue;
+            }
+            if (!component->entity.has_value() || !component->entity->data.has_value()) {
+                withoutParameters = true;
+                continue;
+            }
+
+            WiPdmElementVariables componentVariables;
+            const auto data = fromJson<WiPdmComponentData>(component->entity->data.value());
+            if (data.variables.has_value()) {
+                componentVariables = data.variables.value();
+                // флаг схемы: у элемента нет собственных надежности и вероятности отказа
+                WiPdmElementVariables own = componentVariables;
+                fillAllVars(own, std::nullopt, ec);
+                if (ec) return;
+                if (!own.reliability.has_value() || !own.failure_probability.has_value()) {
+                    withoutParameters = true;
+                }
+            }
+            else {
+                withoutParameters = true;
+            }
+
+            WiPdmElementVariables vars;
+            // Без времени работы схемы или при совпадении его с временем работы изделия блоку достаются переменные компонента
+            std::optional<long int> lifeTime;
+            if (timespan.has_value()) {
+                boost::system::error_code lec;
+                lifeTime = productLifeTime(component->semantic, lec);
+                if (lec || !lifeTime.has_value()) {
+                    withoutParameters = true;
+                    continue;
+                }
+            }
+            if (!timespan.has_value() || lifeTime.value() == static_cast<long int>(timespan.value())) {
+                vars = componentVariables;
+            }
+            else { // Иначе необходимо пересчитать переменные с учетом времени работы схемы
+                vars.failure_rate = componentVariables.failure_rate;
+                fillAllVars(vars, timespan, ec);
+                if (ec) return;
+            }
+
+            WiPdmRbdBlockData block_data;
+            block_data.variables = vars;
+
+            // Блок с теми же значениями не перезаписываем
+            WiPdmRbdBlockData old_data;
+            if (block->entity.has_value() && block->entity->data.has_value()) {
+                old_data = fromJson<decltype(old_data)>(block->entity->data.value());
+            }
+            if (toJson(old_data) == toJson(block_data)) continue;
+
+            WiUpdatePdmNodeQuery updateRBDQuery(*block);
+            updateRBDQuery.data            = toJson(block_data);
+            updateRBDQuery.updateData      = true;
+            updates.push_back(std::move(updateRBDQuery));
+            rates.emplace_back(block->semantic, vars.failure_rate);
+        }
+
+        updateNodes(initiatingService, updates, sessionPtr, Filter::filterOn, ec, yield, mctx);
+        if (ec) return;
+        for (const auto &[semantic, rate] : rates) {
+            patchRbdModelLeaf(schema->semantic, semantic, rate, mctx);
+        }
+    }
+
     void PdmService::BindRbdSchemaWithSubRbdInternal(
                 std::size_t initiatingService,
                 const std::string& RbdSchemaSemantic,
@@ -6829,6 +9823,19 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             return;
         }
 
+        // привязываемая схема не должна сама зависеть от схемы свёртки
+        std::vector<std::vector<std::string>> dependents;
+        orderRbdSchemas(initiatingService, {subRbdParentSemantic}, dependents, sessionPtr, ec, yield, mctx);
+        if(ec) return;
+        for (const auto &level : dependents)
+        {
+            if (std::find(level.begin(), level.end(), RbdSchemaSemantic) != level.end())
+            {
+                ec = make_error_code(error::sub_rbd_cant_be_binded_with_own_parent);
+                return;
+            }
+        }
+
         auto subRbdNode  = fetchRawNode(initiatingService,SubRbdSemantic,sessionPtr, ec, yield, mctx);
         if(ec || !subRbdNode) return;
 
@@ -7584,12 +10591,10 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
                                                 ec, yield, mctx);
             if(ec) return;
         }
-        for(auto& FUupdate: FUupdates)
-        {
-            updateNode(initiatingService, FUupdate, sessionPtr, Filter::filterOn, ec, yield, mctx);
-            if(ec) return;
-        }
-        updateNode(initiatingService, updateQuery, sessionPtr, Filter::filterOn, ec, yield, mctx);
+        // функциональные узлы и сам элемент - одной пачкой
+        std::vector<WiUpdatePdmNodeQuery> updates(std::make_move_iterator(FUupdates.begin()), std::make_move_iterator(FUupdates.end()));
+        updates.push_back(std::move(updateQuery));
+        updateNodes(initiatingService, updates, sessionPtr, Filter::filterOn, ec, yield, mctx);
     }
 
     std::optional<WiSemanticsResult> PdmService::fetchFunctionalUnitsOfPdmElement(
@@ -7920,11 +10925,9 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
                         ec, yield, mctx);
                     if(ec) return;
                 }
-                for(auto& FUupdate: FUupdates)
-                {
-                    updateNode(initiatingService, FUupdate, sessionPtr, Filter::filterOn, ec, yield, mctx);
-                    if(ec) return;
-                }
+                std::vector<WiUpdatePdmNodeQuery> updates(std::make_move_iterator(FUupdates.begin()), std::make_move_iterator(FUupdates.end()));
+                updateNodes(initiatingService, updates, sessionPtr, Filter::filterOn, ec, yield, mctx);
+                if(ec) return;
             }
         }
 
@@ -8027,7 +11030,8 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
                     return std::nullopt;
                 }
             }
-            assignPositional(initiatingService, pos, res->semantic, sessionPtr, ec, yield, 1, mctx);
+            std::vector<WiUpdatePdmNodeQuery> updates;
+            assignPositional(initiatingService, pos, res->semantic, sessionPtr, ec, yield, 1, updates, mctx);
             if (ec) return std::nullopt;
 
             //update bin
@@ -8035,9 +11039,10 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
                 WiUpdatePdmNodeQuery updateBinQuery(bin);
                 updateBinQuery.extension = toJson(binExtension);
                 updateBinQuery.updateExtension = true;
-                updateNode(initiatingService, updateBinQuery, sessionPtr, Filter::filterOn, ec, yield, mctx);
-                if (ec) return std::nullopt;
+                updates.push_back(std::move(updateBinQuery));
             }
+            updateNodes(initiatingService, updates, sessionPtr, Filter::filterOn, ec, yield, mctx);
+            if (ec) return std::nullopt;
         }
 
         // update
@@ -9091,14 +12096,10 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
 
         if(ec) return;
 
-        for(auto& FUupdate: FUupdates)
-        {
-            updateNode(initiatingService, FUupdate, sessionPtr, Filter::filterOn, ec, yield, mctx);
-            if(ec) return;
-        }
-
-        
-        updateNode(initiatingService, updateQuery, sessionPtr, Filter::filterOn, ec, yield, mctx);
+        // функциональные узлы и сам элемент - одной пачкой
+        std::vector<WiUpdatePdmNodeQuery> updates(std::make_move_iterator(FUupdates.begin()), std::make_move_iterator(FUupdates.end()));
+        updates.push_back(updateQuery);
+        updateNodes(initiatingService, updates, sessionPtr, Filter::filterOn, ec, yield, mctx);
         if(ec) return;
 
         if (node->extension.has_value()) {
@@ -10633,16 +13634,35 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             const net::yield_context &yield,
             std::shared_ptr<MethodContextInterface> ctx) const noexcept(true) {
         GUARD_PDM_METHOD();
+        return addNewNodeInternal(initiatingService, query, newNodeSemantic(query.parent), sessionPtr, filter, ec, yield, mctx);
+    }
 
-        boost::ignore_unused(initiatingService);
-
+    std::string PdmService::newNodeSemantic(const std::string &parent) const {
         constexpr static const char *semanticSplitter = "::";
-        std::int64_t nodeId = 0;
-        std::string semantic = query.parent;
+        std::string semantic = parent;
         std::string random = std::to_string((*m_mt)());
 
         semantic.append(semanticSplitter);
         semantic.append(random);
+        return semantic;
+    }
+
+    std::string PdmService::addNewNodeInternal(
+            std::size_t initiatingService,
+            WiNewPdmNodeQuery &query,
+            const std::string &nodeSemantic,
+            const std::shared_ptr<IWiSession> sessionPtr,
+            const Filter &filter,
+            boost::system::error_code &ec,
+            const net::yield_context &yield,
+            std::shared_ptr<MethodContextInterface> ctx) const noexcept(true) {
+        GUARD_PDM_METHOD();
+
+        boost::ignore_unused(initiatingService);
+
+        constexpr static const char *semanticSplitter = "::";
+        std::int64_t nodeId = 0;
+        std::string semantic = nodeSemantic;
 
         std::string headerSemantic = semantic;
         headerSemantic.append(semanticSplitter);
@@ -10694,6 +13714,10 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
                 yield);
 
         if (!ec) {
+            if (auto schema = rbdTopologyOwner(selfSemantic, query.role); schema.has_value()) {
+                invalidateRbdModel(schema.value(), mctx);
+            }
+            invalidateChildRates(query.parent, false, mctx);
             auto rawNewNodePtr = fetchRawNode(selfSemantic, ec, yield, mctx);
             if (!ec && rawNewNodePtr) {
                 IWiPlatform::PdmAddNodeEvent event(m_eventNumerator);
@@ -10751,17 +13775,27 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
 
             initiateRecalculation(initiatingService,sessionPtr,node.semantic,ec,yield,mctx);
             if(ec) return std::nullopt;
+
+            if(auto schema = rbdTopologyOwner(node.semantic, node.role); schema.has_value()) {
+                invalidateRbdModel(schema.value(), mctx);
+            }
         }
 
         if (rawOldNodePtr) {
             DataAccessConst().movePdmNode(0, 0, res.semantic, query.destination, actor, mctx, ec, yield);
             if(!ec) {
+                applyChildRate(rawOldNodePtr->semantic, rawOldNodePtr->role, std::nullopt, mctx);
+                invalidateChildRates(rawOldNodePtr->semantic, true, mctx);
+                invalidateChildRates(query.destination, false, mctx);
+                invalidateRbdExtension(rawOldNodePtr->semantic, true);
                 updateElementSemanticInFailureTypeCache(initiatingService, rawOldNodePtr->semantic, res.semantic, sessionPtr, ec, yield, mctx);
 
                 WiCacheSvc.clear(rawOldNodePtr->semantic);
-                // force update updated node
-                auto newNodePtr = fetchRawNode(res.semantic, ec, yield, mctx, true);
-                if (!ec && newNodePtr) {
+                // перенесенный узел - прежний под новой семантикой, повторно не читается
+                auto newNodePtr = std::make_shared<WiPdmRawNode>(*rawOldNodePtr);
+                newNodePtr->semantic = res.semantic;
+                dropCachedNode(res.semantic);
+                if (!ec) {
                     std::optional<std::string> parentOpt = std::nullopt;
                     {
                         constexpr static const char *semanticSplitter = "::";
@@ -11026,7 +14060,10 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
         }
 
         pos.push_back(1);
-        assignPositionals(initiatingService, pos, nodes, sessionPtr, ec, yield, 1, mctx);
+        std::vector<WiUpdatePdmNodeQuery> updates;
+        assignPositionals(initiatingService, pos, nodes, sessionPtr, ec, yield, 1, updates, mctx);
+        if(ec) return;
+        updateNodes(initiatingService, updates, sessionPtr, Filter::filterOn, ec, yield, mctx);
     }
 
     void PdmService::assignPositionals(
@@ -11037,6 +14074,7 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             boost::system::error_code &ec,
             const net::yield_context &yield,
             std::size_t depth,
+            std::vector<WiUpdatePdmNodeQuery> &updates,
             std::shared_ptr<MethodContextInterface> ctx) const noexcept(true){
         GUARD_PDM_METHOD();
         if(pos.size() == 0) {
@@ -11047,7 +14085,7 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             if(node.role != PdmRoles::Container && node.role != PdmRoles::ProxyComponent && node.role != PdmRoles::ElectricComponent)
                 return;
             std::string sem = node.semantic;
-            assignPositional(initiatingService, pos, sem, sessionPtr, ec, yield, depth, mctx);
+            assignPositional(initiatingService, pos, sem, sessionPtr, ec, yield, depth, updates, mctx);
             if(ec){
                 return;
             }
@@ -11068,6 +14106,7 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             boost::system::error_code &ec,
             const net::yield_context &yield,
             std::size_t depth,
+            std::vector<WiUpdatePdmNodeQuery> &updates,
             std::shared_ptr<MethodContextInterface> ctx) const noexcept(true){
         GUARD_PDM_METHOD();
         std::vector<std::uint32_t> oldPos;
@@ -11097,8 +14136,8 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
                 UpdateQuery.semantic = semantic;
                 UpdateQuery.extension = toJson(ext);
                 UpdateQuery.updateExtension = true;
-                updateNode(initiatingService, UpdateQuery, sessionPtr, Filter::filterOn, ec, yield, mctx);
-                if(ec) return;
+                // узел перечитывается только сам, записи можно отложить до конца обхода
+                updates.push_back(std::move(UpdateQuery));
             }else{// if old and new positional are identical
                 --depth;
             }
@@ -11115,7 +14154,7 @@ class PdmMethodContext:public wi::core::MethodContextInterface, public std::enab
             std::sort(nodes.begin(), nodes.end(), pos_comparer);
         }
         pos.push_back(1);
-        assignPositionals(initiatingService, pos, nodes, sessionPtr, ec, yield, depth, mctx);
+        assignPositionals(initiatingService, pos, nodes, sessionPtr, ec, yield, depth, updates, mctx);
         pos.pop_back();
         return;
     }
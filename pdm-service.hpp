@@ -1,11 +1,18 @@
 #ifndef DM_PDM_SERVICE_HPP
 #define DM_PDM_SERVICE_HPP
 
+#include <chrono>
 #include <functional>
+#include <limits>
 #include <random>
 #include <optional>
+#include <map>
+#include <set>
+#include <mutex>
+#include <unordered_map>
 #include <boost/core/ignore_unused.hpp>
 #include <boost/asio/spawn.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/serialization/singleton.hpp>
 #include <boost/utility/string_view.hpp>
 #include "pdm-roles.hpp"
@@ -36,9 +43,11 @@ using namespace std::chrono_literals;
 namespace wi::basic_services::pdm::internal {
     namespace details {
             struct Node{
-                Node(Number failure_rate):fr(failure_rate){}
+                Node(Number failure_rate, std::string block = {}, std::string element = {}):fr(failure_rate),semantic(std::move(block)),ref(std::move(element)){}
                 BOOST_HANA_DEFINE_STRUCT(Node,
-                                         (Number, fr));
+                                         (Number, fr),
+                                         (std::string, semantic),
+                                         (std::string, ref)); // привязанный компонент или схема
             };
             struct LinearModel;
             struct ReservedModel;
@@ -50,9 +59,194 @@ namespace wi::basic_services::pdm::internal {
                                          (std::vector<RBDPartModel>, chain));
             };
             struct ReservedModel{
-                BOOST_HANA_DEFINE_STRUCT(ReservedModel,(std::vector<RBDPartModel>, chains));
+                BOOST_HANA_DEFINE_STRUCT(ReservedModel,(std::vector<RBDPartModel>, chains),
+                                         (std::uint32_t, k)); // сколько цепочек должно работать, 0 и 1 - обычный резерв
+            };
+
+            enum class RbdOpCode : std::uint8_t {
+                leaf,       // arg - индекс в rates
+                series,     // arg - количество операндов
+                reserved,   // arg - количество операндов
+                voting      // arg - количество операндов, k - сколько из них должно работать
+            };
+            struct RbdOp{
+                RbdOpCode code;
+                std::uint32_t arg;
+                std::uint32_t k = 1;
+            };
+            struct RbdBddNode{
+                std::uint32_t var;
+                std::uint32_t low;  // переменная в отказе
+                std::uint32_t high; // переменная работоспособна
+            };
+            // модель схемы, развернутая в плоскую постфиксную программу
+            struct RbdProgram{
+                std::vector<RbdOp> ops;
+                std::vector<std::uint32_t> sizes;   // размер поддерева каждой операции
+                std::vector<std::uint32_t> parents; // операция-родитель, у корня - max()
+                std::vector<Number> rates;
+                std::vector<std::uint32_t> leafOps; // операция каждого листа из rates
+                std::shared_ptr<const std::vector<std::string>> leaves; // семантики блоков, соответствующих rates, общие для копий программы
+                std::vector<std::uint32_t> leafVars;  // переменная каждого листа, листья одного компонента делят переменную
+                std::vector<std::uint32_t> varLeaves; // первый лист каждой переменной
+                // ROBDD по переменным, строится только если компонент повторяется в схеме
+                std::vector<RbdBddNode> bdd;
+                std::uint32_t bddRoot = 0;
+                std::size_t depth = 0; // максимальная глубина стека вычислений
+                // значения всех операций в момент timespan, для пересчета по пути от листа к корню
+                std::optional<Number> timespan;
+                std::vector<Number> partials;
+                std::uint64_t revision = 0; // меняется при каждой замене интенсивности листа
+            };
+            // изменения моделей схем одной транзакции, в общий кэш попадают только после ее коммита
+            struct RbdModelChanges{
+                std::set<std::string> topology; // схемы с измененной структурой
+                std::map<std::string, std::map<std::string, std::optional<Number>>> leaves; // схема -> блок -> интенсивность
+
+                bool empty() const {
+                    return topology.empty() && leaves.empty();
+                }
+                bool contains(const std::string &schema) const {
+                    return topology.count(schema) || leaves.count(schema);
+                }
+            };
+            // сумма интенсивностей детей, прочитанная транзакцией из базы и поправленная ее же записями
+            struct ChildRatesSum{
+                Number sum;
+                std::unordered_map<std::string, Number> children;
+            };
+            // отложенные пересчеты транзакции
+            struct RecalculationTriggers{
+                // отсортированы лексикографически >, что бы идти от листьев к корню дерева ЛСИ.
+                std::set<std::string,std::greater<std::string>> restored_elements;
+                std::set<std::string,std::greater<std::string>> elements;
+                std::set<std::string> products;
+                std::set<std::string> schemas;
+                std::set<std::string> schemas_flags;
+
+                bool empty() const {
+                    return restored_elements.empty() && elements.empty() && products.empty()
+                        && schemas.empty() && schemas_flags.empty();
+                }
+                void merge(RecalculationTriggers &other) {
+                    restored_elements.merge(other.restored_elements);
+                    elements.merge(other.elements);
+                    products.merge(other.products);
+                    schemas.merge(other.schemas);
+                    schemas_flags.merge(other.schemas_flags);
+                }
+                // убирает цели, которые есть в other
+                void subtract(const RecalculationTriggers &other) {
+                    for(const auto &t : other.restored_elements) restored_elements.erase(t);
+                    for(const auto &t : other.elements) elements.erase(t);
+                    for(const auto &t : other.products) products.erase(t);
+                    for(const auto &t : other.schemas) schemas.erase(t);
+                    for(const auto &t : other.schemas_flags) schemas_flags.erase(t);
+                }
+            };
+            // разобранное расширение элемента ССН, вариант определяется ролью узла
+            using RbdExtension = std::variant<std::monostate,
+                                              WiPdmRbdInputNodeExtension,
+                                              WiPdmRbdOutputNodeExtension,
+                                              WiPdmRbdBlockExtension,
+                                              WiPdmSubRbdExtension,
+                                              WiPdmRbdGroupStartExtension,
+                                              WiPdmRbdGroupEndExtension>;
+            // схема ССН, загруженная одним запросом: узлы пронумерованы, связи разобраны один раз и лежат в CSR
+            struct RbdGraph{
+                static constexpr std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+                std::vector<std::shared_ptr<WiPdmRawNodeEntity>> nodes;
+                std::unordered_map<std::string, std::uint32_t> ids;
+                // выходы узла i - outs[outOffsets[i], outOffsets[i + 1]), входы аналогично;
+                // none - связь ведет на узел вне схемы
+                std::vector<std::uint32_t> outOffsets;
+                std::vector<std::uint32_t> outs;
+                std::vector<std::uint32_t> inOffsets;
+                std::vector<std::uint32_t> ins;
+                std::vector<std::uint32_t> pairs; // для начала группы - ее конец и наоборот, у остальных none
+
+                std::uint32_t find(const std::string &semantic) const {
+                    auto it = ids.find(semantic);
+                    return it == ids.end() ? none : it->second;
+                }
+                std::uint32_t outDegree(std::uint32_t i) const { return outOffsets[i + 1] - outOffsets[i]; }
+                std::uint32_t output(std::uint32_t i, std::uint32_t j = 0) const { return outs[outOffsets[i] + j]; }
+                std::uint32_t inDegree(std::uint32_t i) const { return inOffsets[i + 1] - inOffsets[i]; }
+                std::uint32_t input(std::uint32_t i, std::uint32_t j = 0) const { return ins[inOffsets[i] + j]; }
             };
     }
+
+    // группа k из n: хранится в расширении начала группы рядом с полями WiPdmRbdGroupStartExtension
+    struct WiPdmRbdGroupVotingExtension{
+        BOOST_HANA_DEFINE_STRUCT(WiPdmRbdGroupVotingExtension,
+                                 (std::optional<std::uint32_t>, k));
+    };
+    struct WiRbdGroupVotingQuery{
+        BOOST_HANA_DEFINE_STRUCT(WiRbdGroupVotingQuery,
+                                 (std::string, semantic), // начало группы
+                                 (std::optional<std::uint32_t>, k)); // пусто или 1 - обычный резерв
+    };
+
+    // значимость блока схемы ССН
+    struct WiRbdBlockImportance{
+        BOOST_HANA_DEFINE_STRUCT(WiRbdBlockImportance,
+                                 (std::string, semantic),
+                                 (Number, reliability),
+                                 (Number, birnbaum),      // dR/dR_i
+                                 (std::optional<Number>, criticality)); // dR/dR_i * (1-R_i)/(1-R)
+    };
+    struct WiRbdImportanceResult{
+        BOOST_HANA_DEFINE_STRUCT(WiRbdImportanceResult,
+                                 (std::optional<Number>, reliability),
+                                 (std::vector<WiRbdBlockImportance>, blocks));
+    };
+
+    // кривая надежности R(t) схемы ССН или изделия, без записи в базу
+    struct WiReliabilityCurveQuery{
+        BOOST_HANA_DEFINE_STRUCT(WiReliabilityCurveQuery,
+                                 (std::string, semantic),
+                                 (long double, from),
+                                 (long double, to),
+                                 (std::optional<std::uint32_t>, points)); // сколько точек вернуть
+    };
+    struct WiReliabilityCurvePoint{
+        BOOST_HANA_DEFINE_STRUCT(WiReliabilityCurvePoint,
+                                 (Number, time),
+                                 (Number, reliability));
+    };
+    struct WiReliabilityCurveResult{
+        BOOST_HANA_DEFINE_STRUCT(WiReliabilityCurveResult,
+                                 (std::vector<WiReliabilityCurvePoint>, points));
+    };
+
+    // минимальные сечения/пути схемы ССН
+    struct WiRbdCutSetsQuery{
+        BOOST_HANA_DEFINE_STRUCT(WiRbdCutSetsQuery,
+                                 (std::string, semantic),
+                                 (std::optional<std::uint32_t>, order), // наибольший размер множества, пусто - без усечения
+                                 (std::optional<bool>, paths));         // true - пути вместо сечений
+    };
+    struct WiRbdCutSet{
+        BOOST_HANA_DEFINE_STRUCT(WiRbdCutSet,
+                                 (std::vector<std::string>, blocks)); // блоки одного компонента входят вместе
+    };
+    struct WiRbdCutSetsResult{
+        BOOST_HANA_DEFINE_STRUCT(WiRbdCutSetsResult,
+                                 (std::vector<WiRbdCutSet>, sets));
+    };
+
+    // нарушение структуры схемы ССН
+    struct WiRbdViolation{
+        BOOST_HANA_DEFINE_STRUCT(WiRbdViolation,
+                                 (std::string, semantic), // пусто - нарушение схемы целиком
+                                 (std::int32_t, code),    // код ошибки pdm
+                                 (std::string, reason));
+    };
+    struct WiRbdValidationResult{
+        BOOST_HANA_DEFINE_STRUCT(WiRbdValidationResult,
+                                 (std::vector<WiRbdViolation>, violations));
+    };
+
 class PdmService: public boost::noncopyable, public boost::serialization::singleton<PdmService> {
     public:
 
@@ -60,8 +254,25 @@ class PdmService: public boost::noncopyable, public boost::serialization::single
     public:
 
         void init(IWiPlatform::PlatformEventNumeratorPtr numerator, net::io_context &ios, boost::system::error_code &ec, const net::yield_context &yield);
+        // Пересчеты после коммита выполняются в фоне: цели копятся и схлопываются в течение
+        // rbd_recalculation_debounce, затем одна задача на rbd_update_strand выполняет их в своей транзакции,
+        // цели каждой сессии - от ее имени. Неудачная пачка повторяется до rbd_recalculation_attempts раз,
+        // об исходе каждой пачки сообщают события обновления ее целей
+        void enqueueRecalculation(std::size_t initiatingService, const std::shared_ptr<IWiSession> sessionPtr, details::RecalculationTriggers &triggers) const;
+        // Убирает из пачки цели, снова поставленные в очередь: их результат устарел бы, следующий круг посчитает их заново
+        void dropSupersededRecalculations(details::RecalculationTriggers &triggers) const;
+        // Цели, пересчет которых не удался за rbd_recalculation_attempts попыток; уходят, когда их снова ставят в очередь
+        details::RecalculationTriggers failedRecalculations() const;
+        void recalculateTriggers(
+                std::size_t initiatingService,
+                details::RecalculationTriggers &&triggers,
+                const std::shared_ptr<IWiSession> sessionPtr,
+                boost::system::error_code &ec,
+                const net::yield_context &yield,
+                std::shared_ptr<MethodContextInterface> ctx = nullptr) const noexcept(true);
         void addNewNode(std::size_t initiatingService, WiNewPdmNodeQuery &query, const std::shared_ptr<IWiSession> sessionPtr, const Filter &filter, boost::system::error_code &ec, const net::yield_context &yield, std::shared_ptr<MethodContextInterface> ctx = nullptr) const;
         void updateNode(std::size_t initiatingService, WiUpdatePdmNodeQuery &query, const std::shared_ptr<IWiSession> sessionPtr, const Filter &filter, boost::system::error_code &ec, const net::yield_context &yield, std::shared_ptr<MethodContextInterface> ctx = nullptr) const;
+        void updateNodes(std::size_t initiatingService, std::vector<WiUpdatePdmNodeQuery> &queries, const std::shared_ptr<IWiSession> sessionPtr, const Filter &filter, boost::system::error_code &ec, const net::yield_context &yield, std::shared_ptr<MethodContextInterface> ctx = nullptr) const;
         void deleteNode(std::size_t initiatingService, const std::string &query, const std::shared_ptr<IWiSession> sessionPtr, const Filter &filter, boost::system::error_code &ec, const net::yield_context &yield, std::shared_ptr<MethodContextInterface> ctx = nullptr) const;
 
         // new context methods
@@ -107,6 +318,24 @@ class PdmService: public boost::noncopyable, public boost::serialization::single
             boost::system::error_code &ec,
             const net::yield_context &yield,
             std::shared_ptr<MethodContextInterface> ctx) const noexcept(true);
+        // сумма интенсивностей рассчитанных детей: одним запросом детей, повторно в той же транзакции - из прочитанного
+        std::optional<Number> childRatesSum(
+            std::int64_t initiatingService,
+            const std::string &parent,
+            const std::shared_ptr<IWiSession> sessionPtr,
+            boost::system::error_code &ec,
+            const net::yield_context &yield,
+            std::shared_ptr<MethodContextInterface> ctx) const noexcept(true);
+        // все элементы, контейнеры и само изделие по одному запросу поддерева, снизу вверх в памяти;
+        // записываются только изменившиеся узлы
+        void recalculateProductTree(
+            std::int64_t initiatingService,
+            const WiPdmRawNodeEntity &product,
+            const std::optional<long double> timespan,
+            const std::shared_ptr<IWiSession> sessionPtr,
+            boost::system::error_code &ec,
+            const net::yield_context &yield,
+            std::shared_ptr<MethodContextInterface> ctx) const noexcept(true);
         void recalculateRestoredElement(
             std::int64_t initiatingService,
             const std::string &product,
@@ -226,6 +455,8 @@ class PdmService: public boost::noncopyable, public boost::serialization::single
                 const net::yield_context &yield,
                 std::shared_ptr<MethodContextInterface> ctx) const noexcept(true);
 
+        // точки входа для отдельного запроса: граф схемы загружается на каждый вызов,
+        // имеющий граф вызывающий берет перегрузки по графу ниже
         std::optional<details::ReservedModelPtr> getRbdReservedModel(
                 std::size_t initiatingService,
                 const WiRbdChain &query,
@@ -242,6 +473,97 @@ class PdmService: public boost::noncopyable, public boost::serialization::single
                 const net::yield_context &yield,
                 std::shared_ptr<MethodContextInterface> ctx) const noexcept(true);
 
+        // все элементы схемы одним запросом, связи разобраны в граф
+        std::optional<details::RbdGraph> getRbdGraph(
+                std::size_t initiatingService,
+                const std::string &schema,
+                const std::shared_ptr<IWiSession> sessionPtr,
+                boost::system::error_code &ec,
+                const net::yield_context &yield,
+                std::shared_ptr<MethodContextInterface> ctx = nullptr) const noexcept(true);
+
+        std::optional<details::ReservedModelPtr> getRbdReservedModel(
+                std::size_t initiatingService,
+                const details::RbdGraph &graph,
+                std::uint32_t start,
+                const std::shared_ptr<IWiSession> sessionPtr,
+                boost::system::error_code &ec,
+                const net::yield_context &yield,
+                std::shared_ptr<MethodContextInterface> ctx = nullptr) const noexcept(true);
+
+        std::optional<details::LinearModelPtr> getRbdChainModel(
+                std::size_t initiatingService,
+                const details::RbdGraph &graph,
+                std::uint32_t source,
+                std::uint32_t target,
+                const std::shared_ptr<IWiSession> sessionPtr,
+                boost::system::error_code &ec,
+                const net::yield_context &yield,
+                std::shared_ptr<MethodContextInterface> ctx = nullptr) const noexcept(true);
+
+        // номера блоков и подсхем участка source..target в порядке обхода цепочки, каждый узел посещается один раз
+        void getRbdChainBlocks(
+                const details::RbdGraph &graph,
+                std::uint32_t source,
+                std::uint32_t target,
+                std::vector<std::uint32_t> &blocks,
+                boost::system::error_code &ec) const noexcept(true);
+
+        // время работы схемы: из схемы, иначе из изделия проекта
+        std::optional<long double> getRbdTimespan(
+                std::size_t initiatingService,
+                std::shared_ptr<WiPdmRawNodeEntity> schema,
+                const std::shared_ptr<IWiSession> sessionPtr,
+                boost::system::error_code &ec,
+                const net::yield_context &yield,
+                std::shared_ptr<MethodContextInterface> ctx) const noexcept(true);
+
+        // кэш скомпилированных моделей схем. В общем кэше только подтвержденное состояние:
+        // изменения транзакции видны только ей и публикуются после ее коммита
+        using RbdProgramPtr = std::shared_ptr<const details::RbdProgram>;
+        // версии схемы на момент чтения кэша, построенная модель сохраняется, только если они не изменились
+        struct RbdModelStamp{
+            std::uint64_t topology = 0;
+            std::uint64_t rates = 0;
+            bool local = false;     // схема менялась в транзакции, модель живет только в ней
+            bool unsettled = false; // схему меняет транзакция, коммит которой не отслеживается
+        };
+
+        // скомпилированная модель схемы из кэша или построенная по текущим данным
+        RbdProgramPtr getRbdProgram(
+                std::size_t initiatingService,
+                const std::string &schema,
+                RbdModelStamp &stamp,
+                const std::shared_ptr<IWiSession> sessionPtr,
+                boost::system::error_code &ec,
+                const net::yield_context &yield,
+                std::shared_ptr<MethodContextInterface> ctx) const noexcept(true);
+
+        RbdProgramPtr cachedRbdModel(const std::string &schema, RbdModelStamp &stamp, std::shared_ptr<MethodContextInterface> ctx) const;
+        void storeRbdModel(const std::string &schema, const RbdModelStamp &stamp, RbdProgramPtr program, std::shared_ptr<MethodContextInterface> ctx) const;
+        void patchRbdModelLeaf(const std::string &schema, const std::string &leaf, const std::optional<Number> &rate, std::shared_ptr<MethodContextInterface> ctx) const;
+        void invalidateRbdModel(const std::string &schema, std::shared_ptr<MethodContextInterface> ctx) const;
+        // после коммита транзакции
+        void publishRbdModels(const details::RbdModelChanges &changes) const;
+        // транзакцией владеет внешний вызывающий, ее коммит не виден: схемы не кэшируются, пока она может быть открыта
+        void unsettleRbdModels(const details::RbdModelChanges &changes) const;
+        // сечения зависят только от топологии и живут вместе с моделью в кэше
+        using RbdCutSetsPtr = std::shared_ptr<const std::vector<std::vector<std::uint32_t>>>;
+        RbdCutSetsPtr cachedRbdCutSets(const std::string &schema, std::uint64_t topology, bool paths, std::uint32_t order) const;
+        void storeRbdCutSets(const std::string &schema, std::uint64_t topology, bool paths, std::uint32_t order, RbdCutSetsPtr sets) const;
+
+        // суммы интенсивностей детей контейнеров и изделий: прочитанная сумма живет только в своей транзакции,
+        // изменение ребенка применяется к ней разностью, сброс заставляет перечитать детей из базы.
+        // false - суммы родителя транзакция еще не читала; subtree - сбросить и суммы всех потомков
+        bool cachedChildRates(const std::string &parent, std::optional<Number> &sum, std::shared_ptr<MethodContextInterface> ctx) const;
+        void storeChildRates(const std::string &parent, std::unordered_map<std::string, Number> &&rates, std::shared_ptr<MethodContextInterface> ctx) const;
+        void applyChildRate(const std::string &child, std::int32_t role, const std::optional<Number> &rate, std::shared_ptr<MethodContextInterface> ctx) const;
+        void invalidateChildRates(const std::string &semantic, bool subtree, std::shared_ptr<MethodContextInterface> ctx) const;
+
+        // расширение узла ССН, разбирается один раз на версию узла; для прочих ролей - monostate
+        std::shared_ptr<const details::RbdExtension> rbdExtension(const std::shared_ptr<WiPdmRawNodeEntity> &node) const;
+        void invalidateRbdExtension(const std::string &semantic, bool subtree = false) const;
+
         std::optional<WiSemanticResult> addProduct(
                 std::size_t initiatingService,
                 const WiNewProduct &query,
@@ -250,6 +572,53 @@ class PdmService: public boost::noncopyable, public boost::serialization::single
                 const net::yield_context &yield,
                 std::shared_ptr<MethodContextInterface> ctx = nullptr) const noexcept(true);
 
+        // Порядок пересчета схем по уровням: схема идет после схем, на которые ссылаются ее подсхемы.
+        // В порядок попадают и все схемы, зависящие от переданных. Цикл ссылок - ошибка
+        void orderRbdSchemas(
+                std::size_t initiatingService,
+                const std::set<std::string> &schemas,
+                std::vector<std::vector<std::string>> &levels,
+                const std::shared_ptr<IWiSession> sessionPtr,
+                boost::system::error_code &ec,
+                const net::yield_context &yield,
+                std::shared_ptr<MethodContextInterface> ctx = nullptr) const noexcept(true);
+
+        // задает группе порог k из n
+        void setRbdGroupVoting(
+                std::size_t initiatingService,
+                const WiRbdGroupVotingQuery &query,
+                const std::shared_ptr<IWiSession> sessionPtr,
+                boost::system::error_code &ec,
+                const net::yield_context &yield,
+                std::shared_ptr<MethodContextInterface> ctx = nullptr) const noexcept(true);
+
+        // значимость блоков схемы для времени ее работы, схема не пересчитывается
+        std::optional<WiRbdImportanceResult> getRbdImportance(
+                std::size_t initiatingService,
+                const WiSemanticOnlyQuery &query,
+                const std::shared_ptr<IWiSession> sessionPtr,
+                boost::system::error_code &ec,
+                const net::yield_context &yield,
+                std::shared_ptr<MethodContextInterface> ctx = nullptr) const noexcept(true);
+
+        // R(t) схемы или изделия на отрезке времени, ничего не пересчитывает и не записывает
+        std::optional<WiReliabilityCurveResult> getReliabilityCurve(
+                std::size_t initiatingService,
+                const WiReliabilityCurveQuery &query,
+                const std::shared_ptr<IWiSession> sessionPtr,
+                boost::system::error_code &ec,
+                const net::yield_context &yield,
+                std::shared_ptr<MethodContextInterface> ctx = nullptr) const noexcept(true);
+
+        // минимальные сечения или пути схемы по ее скомпилированной модели, схема не пересчитывается
+        std::optional<WiRbdCutSetsResult> getRbdCutSets(
+                std::size_t initiatingService,
+                const WiRbdCutSetsQuery &query,
+                const std::shared_ptr<IWiSession> sessionPtr,
+                boost::system::error_code &ec,
+                const net::yield_context &yield,
+                std::shared_ptr<MethodContextInterface> ctx = nullptr) const noexcept(true);
+
         void provisionRbdFlags(
                 std::size_t initiatingService,
                 const std::string &schema,
@@ -325,6 +694,17 @@ class PdmService: public boost::noncopyable, public boost::serialization::single
                 const net::yield_context &yield,
                 std::shared_ptr<MethodContextInterface> ctx) const noexcept(true);
 
+        // копия участка схемы от source до target: участок читается одним запросом,
+        // узлы создаются сразу со связями между собой
+        std::optional<WiRbdChain> copyRbdSubgraphInternal(
+                std::size_t initiatingService,
+                const std::string& target_schema_semantic,
+                const WiRbdChain &chain,
+                const std::shared_ptr<IWiSession> sessionPtr,
+                boost::system::error_code &ec,
+                const net::yield_context &yield,
+                std::shared_ptr<MethodContextInterface> ctx) const noexcept(true);
+
         std::optional<WiSemanticResult> copyRbdBlockElement(
                 std::size_t initiatingService,
                 const std::string& target_schema_semantic,
@@ -499,6 +879,17 @@ class PdmService: public boost::noncopyable, public boost::serialization::single
 
 
     private:
+        // удаление элементов одной схемы: итоговые связи считаются в памяти,
+        // каждый затронутый узел записывается один раз
+        void deleteRbdElementsInternal(
+                std::size_t initiatingService,
+                const std::string &schema,
+                const std::set<std::string> &elements,
+                const std::shared_ptr<IWiSession> sessionPtr,
+                boost::system::error_code &ec,
+                const boost::asio::yield_context &yield,
+                std::shared_ptr<MethodContextInterface> ctx = nullptr) const noexcept(true);
+
         void deleteRbdBlock(
                 std::size_t initiatingService,
                 const WiSemanticOnlyQuery &query,
@@ -579,18 +970,40 @@ class PdmService: public boost::noncopyable, public boost::serialization::single
                 std::shared_ptr<MethodContextInterface> ctx = nullptr) const noexcept(true);
 
         void validateRbdGroup(
-                std::size_t initiatingService,
-                const WiRbdChain &group,
+                const details::RbdGraph &graph,
+                std::uint32_t start,
                 bool validate,
+                boost::system::error_code &ec) const noexcept(true);
+
+        // вся структура схемы за один проход по графу: связи, пары групп, достижимость, циклы
+        std::optional<WiRbdValidationResult> validateRbdSchema(
+                std::size_t initiatingService,
+                const WiSemanticOnlyQuery &query,
                 const std::shared_ptr<IWiSession> sessionPtr,
                 boost::system::error_code &ec,
                 const net::yield_context &yield,
                 std::shared_ptr<MethodContextInterface> ctx = nullptr) const noexcept(true);
 
+        void validateRbdGraph(
+                const details::RbdGraph &graph,
+                std::vector<WiRbdViolation> &violations) const noexcept(true);
+        // Известные ответы расчета и проверки ССН: последовательно, параллельно, 2 из 3, мостик,
+        // переполнение BDD и цикл. Расхождения пишутся в лог, вызывается при запуске отладочной сборки
+        bool checkRbdKnownAnswers() const noexcept(true);
+
+        // путь цепочки по графу схемы: без разрывов и циклов, группы на пути парные;
+        // open - концы цепочки ни к чему не подключены
         void validateRbdChain(
-                std::size_t initiatingService,
+                const details::RbdGraph &graph,
                 const WiRbdChain &chain,
                 bool open,
+                boost::system::error_code &ec) const noexcept(true);
+
+        // правка схемы не должна добавлять нарушений: схема после правки сверяется с нарушениями до нее
+        void checkRbdEdit(
+                std::size_t initiatingService,
+                const std::string &schema,
+                const std::vector<WiRbdViolation> &before,
                 const std::shared_ptr<IWiSession> sessionPtr,
                 boost::system::error_code &ec,
                 const net::yield_context &yield,
@@ -1378,16 +1791,33 @@ class PdmService: public boost::noncopyable, public boost::serialization::single
         std::optional<WiPdmNodeView> apply(const WiPdmRawNode &source, boost::system::error_code &ec) const noexcept(true);
 
     private:
+        // Общий шаг updateNode и updateNodes: записывает запрос, подготовленный по прежней версии узла,
+        // сбрасывает кэш узла и слоя родителя и обновляет интенсивность в сумме родителя.
+        // Схема, чью топологию поменяла запись, добавляется в schemas, ее модель сбрасывает вызывающий
+        void writeNodeUpdate(
+                std::size_t initiatingService,
+                const WiPdmRawNode &old,
+                WiUpdatePdmNodeQuery &query,
+                std::set<std::string> &schemas,
+                const std::shared_ptr<IWiSession> sessionPtr,
+                boost::system::error_code &ec,
+                const net::yield_context &yield,
+                std::shared_ptr<MethodContextInterface> ctx = nullptr) const noexcept(true);
+        // сбрасывает закэшированные версии узла и его слоя
+        inline void dropCachedNode(const std::string &semantic) const noexcept(true) {
+            WiCacheSvc.remove<WiPdmRawNode>(semantic);
+            WiCacheSvc.remove<WiPdmRawNodeEntity>(semantic);
+            WiCacheSvc.remove<WiPdmRawNode::Container>(semantic);
+            WiCacheSvc.remove<WiPdmRawNodeEntity::Container>(semantic);
+            invalidateRbdExtension(semantic);
+        }
         inline std::shared_ptr<WiPdmRawNode> fetchRawNode(
             const std::string &semantic,
             boost::system::error_code &ec, const net::yield_context &yield,std::shared_ptr<MethodContextInterface> ctx, bool forceUpdate=false) const noexcept(true) {
             GUARD_PDM_METHOD_PUB();
             boost::ignore_unused(mctx);
             if(forceUpdate){
-                WiCacheSvc.remove<WiPdmRawNode>(semantic);
-                WiCacheSvc.remove<WiPdmRawNodeEntity>(semantic);
-                WiCacheSvc.remove<WiPdmRawNode::Container>(semantic);
-                WiCacheSvc.remove<WiPdmRawNodeEntity::Container>(semantic);
+                dropCachedNode(semantic);
             }
             return WiCacheSvc.getAsync<WiPdmRawNode>(semantic, mctx, ec, yield);
         }
@@ -1395,10 +1825,7 @@ class PdmService: public boost::noncopyable, public boost::serialization::single
             GUARD_PDM_METHOD_PUB();
             boost::ignore_unused(mctx);
             if(forceUpdate){
-                WiCacheSvc.remove<WiPdmRawNode>(semantic);
-                WiCacheSvc.remove<WiPdmRawNodeEntity>(semantic);
-                WiCacheSvc.remove<WiPdmRawNode::Container>(semantic);
-                WiCacheSvc.remove<WiPdmRawNodeEntity::Container>(semantic);
+                dropCachedNode(semantic);
             }
             return WiCacheSvc.getAsync<WiPdmRawNode::Container>(semantic, mctx, ec, yield);
         }
@@ -1477,6 +1904,20 @@ class PdmService: public boost::noncopyable, public boost::serialization::single
                 const boost::asio::yield_context &yield,
                 std::shared_ptr<MethodContextInterface> ctx = nullptr) const noexcept(true);
 
+        // Пересчитывает переменные всех переданных блоков схемы в памяти, записывает только изменившиеся
+        // timespan - время работы схемы из getRbdTimespan
+        // withoutParameters - есть блок, чей элемент без надежности или вероятности отказа или битый
+        void fillRbdBlocksVars(
+                std::size_t initiatingService,
+                std::shared_ptr<WiPdmRawNodeEntity> schema,
+                const std::vector<std::shared_ptr<WiPdmRawNodeEntity>> &blocks,
+                const std::optional<long double> &timespan,
+                bool &withoutParameters,
+                const std::shared_ptr<IWiSession> sessionPtr,
+                boost::system::error_code &ec,
+                const boost::asio::yield_context &yield,
+                std::shared_ptr<MethodContextInterface> ctx = nullptr) const noexcept(true);
+
         void BindRbdSchemaWithSubRbdInternal(
                 std::size_t initiatingService,
                 const std::string& RbdSchemaSemantic,
@@ -1589,6 +2030,18 @@ class PdmService: public boost::noncopyable, public boost::serialization::single
                 const net::yield_context &yield,
                 std::shared_ptr<MethodContextInterface> ctx = nullptr) const noexcept(true);
 
+        // семантика для узла, созданного заранее выбранной: нужна, когда на узел ссылаются до его создания
+        std::string newNodeSemantic(const std::string &parent) const;
+        std::string addNewNodeInternal(
+                std::size_t initiatingService,
+                WiNewPdmNodeQuery &query,
+                const std::string &semantic,
+                const std::shared_ptr<IWiSession> sessionPtr,
+                const Filter &filter,
+                boost::system::error_code &ec,
+                const net::yield_context &yield,
+                std::shared_ptr<MethodContextInterface> ctx = nullptr) const noexcept(true);
+
         std::optional<WiSemanticResult> moveNodeInternal(
                 std::size_t initiatingService,
                 const WiMovePdmNodeQuery &query,
@@ -1619,6 +2072,7 @@ class PdmService: public boost::noncopyable, public boost::serialization::single
                 const net::yield_context &yield,
                 std::shared_ptr<MethodContextInterface> ctx = nullptr) const noexcept(true);
 
+        // Новые позиционные индексы копятся в updates, вызывающий записывает их одним updateNodes
         void assignPositionals(
                 std::size_t initiatingService,
                 std::vector<std::uint32_t> &pos,
@@ -1627,6 +2081,7 @@ class PdmService: public boost::noncopyable, public boost::serialization::single
                 boost::system::error_code &ec,
                 const net::yield_context &yield,
                 std::size_t depth,
+                std::vector<WiUpdatePdmNodeQuery> &updates,
                 std::shared_ptr<MethodContextInterface> ctx = nullptr) const noexcept(true);
 
         void assignPositional(
@@ -1637,6 +2092,7 @@ class PdmService: public boost::noncopyable, public boost::serialization::single
                 boost::system::error_code &ec,
                 const net::yield_context &yield,
                 std::size_t depth,
+                std::vector<WiUpdatePdmNodeQuery> &updates,
                 std::shared_ptr<MethodContextInterface> ctx = nullptr) const noexcept(true);
 
         void checkElementDestination(
@@ -2063,9 +2519,49 @@ class PdmService: public boost::noncopyable, public boost::serialization::single
         WiPdmStatus::Map m_statuses;
         std::int32_t m_defaultLanguage;
         mutable IWiPlatform::PlatformEventNumeratorPtr m_eventNumerator;
-        std::shared_ptr<net::io_context::strand> container_update_strand;
-        std::shared_ptr<net::io_context::strand> product_update_strand;
         std::shared_ptr<net::io_context::strand> rbd_update_strand;
+        net::io_context *m_ios = nullptr;
+
+        struct RecalculationBatch{
+            std::size_t initiatingService = 0;
+            std::shared_ptr<IWiSession> sessionPtr; // сессия, чьи изменения пересчитываются
+            details::RecalculationTriggers triggers;
+            std::size_t attempts = 0; // неудачных попыток
+        };
+        struct RecalculationQueue{
+            std::vector<RecalculationBatch> batches; // цель лежит только в одной пачке
+            bool scheduled = false; // фоновая задача уже запущена и заберет новые цели
+            details::RecalculationTriggers failed; // исчерпали попытки, ждут следующего изменения
+        };
+        mutable std::mutex m_recalculationMutex;
+        mutable RecalculationQueue m_recalculation;
+        // Сообщает об исходе пачки событием обновления по каждой ее цели в отдельной транзакции
+        void notifyRecalculation(const RecalculationBatch &batch, bool failed, const net::yield_context &yield) const;
+
+        struct RbdModelEntry{
+            std::uint64_t topology = 0;
+            std::uint64_t rates = 0;
+            RbdProgramPtr program;
+            std::map<std::pair<bool, std::uint32_t>, RbdCutSetsPtr> cutSets; // (пути, порядок усечения)
+        };
+        struct RbdSchemaVersion{
+            std::uint64_t topology = 0;
+            std::uint64_t rates = 0;
+            std::chrono::steady_clock::time_point unsettled; // до этого момента модель схемы не кэшируется
+        };
+        mutable std::mutex m_rbdModelsMutex;
+        mutable std::unordered_map<std::string, RbdSchemaVersion> m_rbdVersions;
+        mutable std::unordered_map<std::string, RbdModelEntry> m_rbdModels;
+
+        struct RbdExtensionEntry{
+            std::weak_ptr<const WiPdmRawNodeEntity> node; // экземпляр из кэша узлов, для которого разобрано
+            std::int32_t role = 0;
+            std::optional<nlohmann::json> extension; // разобранное расширение, сверяется только для других экземпляров узла
+            std::shared_ptr<const details::RbdExtension> decoded;
+        };
+        mutable std::mutex m_rbdExtensionsMutex;
+        // упорядочен по семантике, что бы сбрасывать поддерево удаленного или перенесенного узла
+        mutable std::map<std::string, RbdExtensionEntry> m_rbdExtensions;
     };
 }
 
@@ -1,3 +1,72 @@
+// блоки и подсхемы участка source..target по загруженному графу схемы, без рекурсии.
+// Ветви группы обходятся до ее конца не включительно, конец группы - продолжением после всех ветвей,
+// так что каждый узел посещается ровно один раз и порядок совпадает с обходом цепочки
+void PdmService::getRbdChainBlocks(
+            const details::RbdGraph &graph,
+            std::uint32_t source,
+            std::uint32_t target,
+            std::vector<std::uint32_t> &blocks,
+            boost::system::error_code &ec) const noexcept(true)
+    {
+        struct Frame{
+            std::uint32_t node;
+            std::uint32_t stop;
+            bool inclusive; // false - ветвь группы, stop это конец группы
+        };
+        std::vector<bool> visited(graph.nodes.size(), false);
+        std::vector<Frame> stack;
+        stack.push_back({source, target, true});
+        while (!stack.empty())
+        {
+            auto frame = stack.back();
+            stack.pop_back();
+            auto i = frame.node;
+            while (true)
+            {
+                if (i == details::RbdGraph::none) {
+                    ec = make_error_code(error::node_not_found);
+                    return;
+                }
+                if (!frame.inclusive && i == frame.stop) break;
+                // повторный заход - цикл или связь в обход группы
+                if (visited[i]) {
+                    ec = make_error_code(error::invalid_rbd_element);
+                    return;
+                }
+                visited[i] = true;
+
+                const auto role = graph.nodes[i]->role;
+                if (role == PdmRoles::RbdBlock || role == PdmRoles::SubRbd)
+                {
+                    blocks.push_back(i);
+                }
+                else if (role == PdmRoles::RbdGroupStart)
+                {
+                    const auto end = graph.pairs[i];
+                    if (end == details::RbdGraph::none) {
+                        ec = make_error_code(error::invalid_rbd_element);
+                        return;
+                    }
+                    // сначала ветви по порядку, затем продолжение с конца группы
+                    stack.push_back({end, i == frame.stop ? end : frame.stop, frame.inclusive});
+                    for (std::uint32_t j = graph.outDegree(i); j-- > 0;) {
+                        stack.push_back({graph.output(i, j), end, false});
+                    }
+                    break;
+                }
+
+                // end loop condition
+                if (i == frame.stop) break;
+
+                if (graph.outDegree(i) != 1) {
+                    ec = make_error_code(error::invalid_rbd_element);
+                    return;
+                }
+                i = graph.output(i);
+            }
+        }
+    }
+
 void PdmService::getRbdChainSemantics(
             std::size_t initiatingService,
             std::vector<std::string>& copies,
@@ -9,47 +78,27 @@ void PdmService::getRbdChainSemantics(
     {
         GUARD_PDM_METHOD();
 
-        auto start_node = fetchRawNodeEntity(initiatingService,chain.source,sessionPtr, ec, yield, mctx);
-        if (ec || !start_node) return;
-
-        auto end_node = fetchRawNodeEntity(initiatingService,chain.target,sessionPtr, ec, yield, mctx);
-        if (ec || !end_node) return;
+        auto schema = parentSemantic(chain.source, ec);
+        if (ec) return;
+        auto graph = getRbdGraph(initiatingService, schema, sessionPtr, ec, yield, mctx);
+        if (ec || !graph) return;
 
-        do
-        {
-            if (start_node->role == PdmRoles::RbdBlock || start_node->role == PdmRoles::SubRbd)
-            {
-                copies.push_back(start_node->semantic);
-            }
-            else if (start_node->role == PdmRoles::RbdGroupStart)
-            {
-                auto group = getRbdGroup(initiatingService,start_node->semantic,sessionPtr, ec, yield, mctx);
-                if (ec || !group.has_value()) return;
-
-                getRbdGroupSemantics(initiatingService, copies, group.value(), sessionPtr, ec, yield, mctx);
-                if (ec) return;
-
-                start_node = fetchRawNodeEntity(initiatingService,group.value().target,sessionPtr, ec, yield, mctx);
-                if (ec) return;
-            }
-
-            // end loop condition
-            if(start_node->semantic == end_node->semantic)
-                break;
-
-            std::optional<std::string> output;
-            getRbdElementOutput(initiatingService, start_node, output, sessionPtr, ec, yield, mctx);
-            if (ec) return;
-
-            if (!output.has_value()) {
-                ec = make_error_code(error::invalid_rbd_element);
-                return;
-            }
+        const auto source = graph->find(chain.source);
+        const auto target = graph->find(chain.target);
+        if (source == details::RbdGraph::none || target == details::RbdGraph::none) {
+            ec = make_error_code(error::node_not_found);
+            return;
+        }
 
-            start_node = fetchRawNodeEntity(initiatingService,output.value(),sessionPtr, ec, yield, mctx);
-            if (ec) return;
+        std::vector<std::uint32_t> blocks;
+        getRbdChainBlocks(graph.value(), source, target, blocks, ec);
+        if (ec) return;
 
-        } while(true);
+        // семантики разрешаются только в конце
+        copies.reserve(copies.size() + blocks.size());
+        for (const auto i : blocks) {
+            copies.push_back(graph->nodes[i]->semantic);
+        }
     }
 
     void PdmService::getRbdGroupSemantics(
@@ -63,33 +112,33 @@ void PdmService::getRbdChainSemantics(
     {
         GUARD_PDM_METHOD();
 
-        auto start_node = fetchRawNodeEntity(initiatingService,group.source,sessionPtr,ec,yield,mctx);
-        if(ec || !start_node) return;
+        auto schema = parentSemantic(group.source, ec);
+        if (ec) return;
+        auto graph = getRbdGraph(initiatingService, schema, sessionPtr, ec, yield, mctx);
+        if (ec || !graph) return;
 
-        if(start_node->role != PdmRoles::RbdGroupStart){
-            ec = make_error_code(error::invalid_rbd_element);
+        const auto start = graph->find(group.source);
+        const auto end = graph->find(group.target);
+        if (start == details::RbdGraph::none || end == details::RbdGraph::none) {
+            ec = make_error_code(error::node_not_found);
             return;
         }
 
-        auto end_node = fetchRawNodeEntity(initiatingService,group.target,sessionPtr,ec,yield,mctx);
-        if(ec || !end_node) return;
-
-        if(end_node->role != PdmRoles::RbdGroupEnd){
+        if(graph->nodes[start]->role != PdmRoles::RbdGroupStart){
+            ec = make_error_code(error::invalid_rbd_element);
+            return;
+        }
+        if(graph->nodes[end]->role != PdmRoles::RbdGroupEnd || graph->pairs[start] != end){
             ec = make_error_code(error::invalid_rbd_element);
             return;
         }
 
-        std::vector<std::string> orig_outputs;
-        getRbdElementOutputs(initiatingService,start_node,orig_outputs,sessionPtr,ec,yield,mctx);
-        if(ec) return;
-
-        for(const auto& orig_output: orig_outputs)
-        {
-            WiRbdChain orig_chain;
-            orig_chain.source = orig_output;
-            orig_chain.target = group.target;
+        std::vector<std::uint32_t> blocks;
+        getRbdChainBlocks(graph.value(), start, end, blocks, ec);
+        if (ec) return;
 
-            getRbdChainSemantics(initiatingService, copies, orig_chain,sessionPtr,ec,yield,mctx);
-            if (ec) return;
+        copies.reserve(copies.size() + blocks.size());
+        for (const auto i : blocks) {
+            copies.push_back(graph->nodes[i]->semantic);
         }
     }